@@ -0,0 +1,476 @@
+#include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Multi-threaded allocator benchmarks. The harness only calls the C library's
+ * allocation functions, so the same binary measures glibc when run directly
+ * and my_malloc when run with LD_PRELOAD=libmymalloc.so
+ *
+ * Each workload runs in its own child process so its peak RSS is measured in
+ * isolation. Every eighth call is timed to build a latency histogram
+ */
+
+#define MAX_THREADS 256
+
+/* Only one in this many operations is timed */
+#define SAMPLE_MASK 7
+
+/* Values below this many nanoseconds get a histogram bucket each */
+#define HIST_LINEAR 16
+
+/* Sub-buckets per power of two above HIST_LINEAR */
+#define HIST_SUB_BITS 3
+#define HIST_BUCKETS (HIST_LINEAR + (64 << HIST_SUB_BITS))
+
+/* Live blocks each Larson thread holds */
+#define LARSON_SLOTS 1000
+
+/* Operations between a Larson thread handing its blocks to another thread */
+#define LARSON_ROUND (LARSON_SLOTS * 4)
+
+/* Blocks in flight between a producer and its consumer */
+#define RING_SIZE 1024
+
+/* Live blocks each scaling thread holds */
+#define SCALING_SLOTS 64
+
+/* Live blocks each churn thread holds */
+#define CHURN_SLOTS 4096
+
+typedef struct histogram {
+  uint64_t counts[HIST_BUCKETS];
+} histogram;
+
+/* Result a workload's child process sends back to the parent */
+typedef struct result {
+  uint64_t ops;
+  uint64_t nanos;
+  uint64_t p99;
+} result;
+
+typedef struct ring {
+  void * slots[RING_SIZE];
+  size_t head __attribute__ ((aligned (64)));
+  size_t tail __attribute__ ((aligned (64)));
+} ring;
+
+typedef struct worker {
+  pthread_t thread;
+  int id;
+  uint64_t ops;
+  uint64_t rng;
+  histogram hist;
+} worker;
+
+static int numThreads = 4;
+static uint64_t opsPerThread = 1000000;
+static const char * allocatorName = "glibc";
+
+static pthread_barrier_t startBarrier;
+
+/* Larson block arrays waiting to be picked up by another thread */
+static void ** mailbox[MAX_THREADS];
+
+static ring * rings;
+
+/**
+ * @brief Current time of the monotonic clock
+ *
+ * @return nanoseconds since an arbitrary point
+ */
+static inline uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * @brief xorshift64* step of a thread's random number generator
+ *
+ * @param w the worker whose generator to advance
+ *
+ * @return the next random number
+ */
+static inline uint64_t next_random(worker * w) {
+  w->rng ^= w->rng >> 12;
+  w->rng ^= w->rng << 25;
+  w->rng ^= w->rng >> 27;
+  return w->rng * 0x2545F4914F6CDD1DULL;
+}
+
+/**
+ * @brief Random size with every power of two between min and max equally
+ *        likely, so small sizes dominate like in real programs
+ *
+ * @param w the worker whose generator to use
+ * @param min_bits log2 of the smallest size
+ * @param max_bits log2 of the largest size
+ *
+ * @return the size
+ */
+static inline size_t random_size(worker * w, int min_bits, int max_bits) {
+  uint64_t r = next_random(w);
+  int bits = min_bits + r % (max_bits - min_bits);
+  size_t base = (size_t) 1 << bits;
+  return base + (r >> 32) % base;
+}
+
+static inline int bucket_index(uint64_t v) {
+  if (v < HIST_LINEAR) {
+    return v;
+  }
+  int msb = 63 - __builtin_clzll(v);
+  int sub = (v >> (msb - HIST_SUB_BITS)) & ((1 << HIST_SUB_BITS) - 1);
+  return HIST_LINEAR + ((msb - 4) << HIST_SUB_BITS) + sub;
+}
+
+/**
+ * @brief Inverse of bucket_index
+ *
+ * @param i the bucket
+ *
+ * @return the largest value falling into the bucket
+ */
+static uint64_t bucket_value(int i) {
+  if (i < HIST_LINEAR) {
+    return i;
+  }
+  int msb = ((i - HIST_LINEAR) >> HIST_SUB_BITS) + 4;
+  uint64_t sub = (i - HIST_LINEAR) & ((1 << HIST_SUB_BITS) - 1);
+  uint64_t step = (uint64_t) 1 << (msb - HIST_SUB_BITS);
+  return ((uint64_t) 1 << msb) + (sub + 1) * step - 1;
+}
+
+static uint64_t percentile(histogram * h, double p) {
+  uint64_t total = 0;
+  for (int i = 0; i < HIST_BUCKETS; i++) {
+    total += h->counts[i];
+  }
+  uint64_t rank = total * p;
+  uint64_t seen = 0;
+  for (int i = 0; i < HIST_BUCKETS; i++) {
+    seen += h->counts[i];
+    if (seen > rank) {
+      return bucket_value(i);
+    }
+  }
+  return 0;
+}
+
+/**
+ * @brief Start timing an operation if it is one of the sampled ones
+ *
+ * @param w the worker doing the operation
+ *
+ * @return the start time or 0 if the operation is not sampled
+ */
+static inline uint64_t op_start(worker * w) {
+  return (w->ops & SAMPLE_MASK) == 0 ? now_ns() : 0;
+}
+
+static inline void op_end(worker * w, uint64_t start) {
+  if (start != 0) {
+    w->hist.counts[bucket_index(now_ns() - start)]++;
+  }
+  w->ops++;
+}
+
+static void * timed_malloc(worker * w, size_t size) {
+  uint64_t start = op_start(w);
+  char * p = malloc(size);
+  op_end(w, start);
+  // Touch the block like a real program would
+  p[0] = (char) size;
+  return p;
+}
+
+static void * timed_realloc(worker * w, void * p, size_t size) {
+  uint64_t start = op_start(w);
+  char * q = realloc(p, size);
+  op_end(w, start);
+  q[size - 1] = (char) size;
+  return q;
+}
+
+static void timed_free(worker * w, void * p) {
+  uint64_t start = op_start(w);
+  free(p);
+  op_end(w, start);
+}
+
+static void ** larson_fill(worker * w) {
+  void ** blocks = malloc(LARSON_SLOTS * sizeof(void *));
+  for (int i = 0; i < LARSON_SLOTS; i++) {
+    blocks[i] = malloc(random_size(w, 4, 10));
+  }
+  return blocks;
+}
+
+/**
+ * @brief Larson server simulation: each thread replaces random blocks in its
+ *        array, and after every round swaps the array for one another
+ *        thread left behind so blocks are freed by a thread other than the
+ *        one that allocated them
+ */
+static void * larson(void * arg) {
+  worker * w = arg;
+  void ** blocks = larson_fill(w);
+  mailbox[w->id] = larson_fill(w);
+  pthread_barrier_wait(&startBarrier);
+
+  while (w->ops < opsPerThread) {
+    for (int i = 0; i < LARSON_ROUND / 2; i++) {
+      int slot = next_random(w) % LARSON_SLOTS;
+      timed_free(w, blocks[slot]);
+      blocks[slot] = timed_malloc(w, random_size(w, 4, 10));
+    }
+    int other = (w->id + 1 + next_random(w) % numThreads) % numThreads;
+    blocks = __atomic_exchange_n(&mailbox[other], blocks, __ATOMIC_ACQ_REL);
+  }
+
+  for (int i = 0; i < LARSON_SLOTS; i++) {
+    free(blocks[i]);
+  }
+  free(blocks);
+  return NULL;
+}
+
+/**
+ * @brief Even threads allocate and pass each block through a ring to the
+ *        next odd thread, which frees it
+ */
+static void * prodcons(void * arg) {
+  worker * w = arg;
+  ring * r = &rings[w->id / 2];
+  bool producer = w->id % 2 == 0;
+  pthread_barrier_wait(&startBarrier);
+
+  for (uint64_t i = 0; i < opsPerThread; i++) {
+    if (producer) {
+      void * p = timed_malloc(w, random_size(w, 4, 10));
+      size_t tail = r->tail;
+      while (tail - __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) == RING_SIZE) {
+        sched_yield();
+      }
+      r->slots[tail % RING_SIZE] = p;
+      __atomic_store_n(&r->tail, tail + 1, __ATOMIC_RELEASE);
+    } else {
+      size_t head = r->head;
+      while (__atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) == head) {
+        sched_yield();
+      }
+      void * p = r->slots[head % RING_SIZE];
+      __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+      timed_free(w, p);
+    }
+  }
+  return NULL;
+}
+
+/**
+ * @brief Thread-local small object FIFO, which shows how throughput scales
+ *        when threads share nothing but the allocator
+ */
+static void * scaling(void * arg) {
+  worker * w = arg;
+  void * blocks[SCALING_SLOTS] = { NULL };
+  pthread_barrier_wait(&startBarrier);
+
+  for (uint64_t i = 0; w->ops < opsPerThread; i++) {
+    void ** slot = &blocks[i % SCALING_SLOTS];
+    if (*slot != NULL) {
+      timed_free(w, *slot);
+    }
+    *slot = timed_malloc(w, random_size(w, 4, 8));
+  }
+
+  for (int i = 0; i < SCALING_SLOTS; i++) {
+    free(blocks[i]);
+  }
+  return NULL;
+}
+
+/**
+ * @brief Random sizes from 8 bytes to 64KB are allocated, resized and freed
+ *        in random order, fragmenting the heap
+ */
+static void * churn(void * arg) {
+  worker * w = arg;
+  void ** blocks = calloc(CHURN_SLOTS, sizeof(void *));
+  size_t * sizes = calloc(CHURN_SLOTS, sizeof(size_t));
+  pthread_barrier_wait(&startBarrier);
+
+  while (w->ops < opsPerThread) {
+    uint64_t r = next_random(w);
+    int slot = r % CHURN_SLOTS;
+    if (blocks[slot] == NULL) {
+      sizes[slot] = random_size(w, 3, 16);
+      blocks[slot] = timed_malloc(w, sizes[slot]);
+    } else if ((r >> 32) % 8 == 0) {
+      sizes[slot] += sizes[slot] / 2 + 1;
+      blocks[slot] = timed_realloc(w, blocks[slot], sizes[slot]);
+    } else {
+      timed_free(w, blocks[slot]);
+      blocks[slot] = NULL;
+    }
+  }
+
+  for (int i = 0; i < CHURN_SLOTS; i++) {
+    free(blocks[i]);
+  }
+  free(blocks);
+  free(sizes);
+  return NULL;
+}
+
+/**
+ * @brief Run a workload on a number of threads in this process
+ *
+ * @param fn the workload each thread runs
+ * @param threads number of threads
+ *
+ * @return operations done, time taken and latency
+ */
+static result run_threads(void * (*fn)(void *), int threads) {
+  worker * workers = calloc(threads, sizeof(worker));
+  rings = calloc((threads + 1) / 2, sizeof(ring));
+  pthread_barrier_init(&startBarrier, NULL, threads + 1);
+
+  for (int i = 0; i < threads; i++) {
+    workers[i].id = i;
+    workers[i].rng = 0x9E3779B97F4A7C15ULL * (i + 1);
+    pthread_create(&workers[i].thread, NULL, fn, &workers[i]);
+  }
+  pthread_barrier_wait(&startBarrier);
+  uint64_t start = now_ns();
+  for (int i = 0; i < threads; i++) {
+    pthread_join(workers[i].thread, NULL);
+  }
+  uint64_t end = now_ns();
+
+  result res = { .ops = 0, .nanos = end - start };
+  histogram * total = calloc(1, sizeof(histogram));
+  for (int i = 0; i < threads; i++) {
+    res.ops += workers[i].ops;
+    for (int b = 0; b < HIST_BUCKETS; b++) {
+      total->counts[b] += workers[i].hist.counts[b];
+    }
+  }
+  res.p99 = percentile(total, 0.99);
+  return res;
+}
+
+/**
+ * @brief Run a workload in a child process and print a line of results
+ *
+ * @param name the workload's name
+ * @param fn the workload each thread runs
+ * @param threads number of threads
+ */
+static void run_workload(const char * name, void * (*fn)(void *), int threads) {
+  int fds[2];
+  if (pipe(fds) != 0) {
+    perror("pipe");
+    exit(1);
+  }
+  fflush(stdout);
+
+  pid_t pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    exit(1);
+  }
+  if (pid == 0) {
+    close(fds[0]);
+    result res = run_threads(fn, threads);
+    if (write(fds[1], &res, sizeof(res)) != sizeof(res)) {
+      _exit(1);
+    }
+    _exit(0);
+  }
+
+  close(fds[1]);
+  result res;
+  ssize_t n = read(fds[0], &res, sizeof(res));
+  close(fds[0]);
+  int status;
+  struct rusage usage;
+  wait4(pid, &status, 0, &usage);
+  if (n != sizeof(res) || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    printf("%-14s %-10s %7d  failed\n", allocatorName, name, threads);
+    return;
+  }
+
+  printf("%-14s %-10s %7d %14.0f %8lu %12ld\n", allocatorName, name, threads,
+         res.ops / (res.nanos / 1e9), (unsigned long) res.p99, usage.ru_maxrss);
+}
+
+static void usage(const char * prog) {
+  fprintf(stderr, "usage: %s [-t threads] [-n ops per thread] "
+          "[larson|prodcons|scaling|churn ...]\n", prog);
+  exit(1);
+}
+
+int main(int argc, char ** argv) {
+  int opt;
+  while ((opt = getopt(argc, argv, "t:n:")) != -1) {
+    switch (opt) {
+      case 't':
+        numThreads = atoi(optarg);
+        break;
+      case 'n':
+        opsPerThread = strtoull(optarg, NULL, 10);
+        break;
+      default:
+        usage(argv[0]);
+    }
+  }
+  if (numThreads < 1 || numThreads > MAX_THREADS || opsPerThread == 0) {
+    usage(argv[0]);
+  }
+
+  // Name the allocator after the preloaded library, if any
+  const char * preload = getenv("LD_PRELOAD");
+  if (preload != NULL && preload[0] != '\0') {
+    const char * slash = strrchr(preload, '/');
+    allocatorName = slash != NULL ? slash + 1 : preload;
+  }
+
+  const char * all[] = { "larson", "prodcons", "scaling", "churn" };
+  char ** workloads = argv + optind;
+  int numWorkloads = argc - optind;
+  if (numWorkloads == 0) {
+    workloads = (char **) all;
+    numWorkloads = sizeof(all) / sizeof(all[0]);
+  }
+
+  printf("%-14s %-10s %7s %14s %8s %12s\n", "allocator", "workload",
+         "threads", "ops/s", "p99 ns", "peak RSS KB");
+  for (int i = 0; i < numWorkloads; i++) {
+    if (strcmp(workloads[i], "larson") == 0) {
+      run_workload("larson", larson, numThreads);
+    } else if (strcmp(workloads[i], "prodcons") == 0) {
+      // Threads come in producer and consumer pairs
+      run_workload("prodcons", prodcons, numThreads < 2 ? 2 : numThreads & ~1);
+    } else if (strcmp(workloads[i], "scaling") == 0) {
+      for (int t = 1; t < numThreads; t *= 2) {
+        run_workload("scaling", scaling, t);
+      }
+      run_workload("scaling", scaling, numThreads);
+    } else if (strcmp(workloads[i], "churn") == 0) {
+      run_workload("churn", churn, numThreads);
+    } else {
+      usage(argv[0]);
+    }
+  }
+}
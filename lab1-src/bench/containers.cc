@@ -0,0 +1,128 @@
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <memory_resource>
+#include <string>
+#include <vector>
+
+#include "../myMalloc.hh"
+
+/*
+ * Single-threaded benchmarks of standard containers with std::allocator,
+ * MyAllocator and std::pmr allocators over MyMallocResource and
+ * MyRegionResource. my_malloc is linked in directly, so std::allocator
+ * measures the C library's allocator through operator new in the same run
+ *
+ * The workloads follow the shell and the web server: a command's vector of
+ * argument pointers, header lines built as strings, a map of open
+ * connections and a list used as a queue
+ */
+
+/* Rounds of each workload */
+#define ROUNDS 20000
+
+/* Elements each round of a workload creates */
+#define ROUND_SIZE 64
+
+template <class A, class T>
+using Rebind = typename std::allocator_traits<A>::template rebind_alloc<T>;
+
+template <class A>
+using String = std::basic_string<char, std::char_traits<char>, Rebind<A, char>>;
+
+template <class A>
+static void arguments(const A & alloc) {
+  std::vector<std::string *, Rebind<A, std::string *>> args(alloc);
+  for (int i = 0; i < ROUND_SIZE; i++) {
+    args.push_back(nullptr);
+  }
+}
+
+template <class A>
+static void headers(const A & alloc) {
+  std::vector<String<A>, Rebind<A, String<A>>> lines(alloc);
+  for (int i = 0; i < ROUND_SIZE; i++) {
+    String<A> line("Content-Type: text/html; charset=utf-8", alloc);
+    line += "\r\nContent-Length: ";
+    line += std::to_string(i).c_str();
+    lines.push_back(std::move(line));
+  }
+}
+
+template <class A>
+static void connections(const A & alloc) {
+  std::map<int, int, std::less<int>, Rebind<A, std::pair<const int, int>>> open(alloc);
+  for (int i = 0; i < ROUND_SIZE; i++) {
+    open[(i * 37) % ROUND_SIZE] = i;
+  }
+  for (int i = 0; i < ROUND_SIZE; i += 2) {
+    open.erase(i);
+  }
+}
+
+template <class A>
+static void queue(const A & alloc) {
+  std::list<int, Rebind<A, int>> q(alloc);
+  for (int i = 0; i < ROUND_SIZE; i++) {
+    q.push_back(i);
+    if (i % 3 == 0) {
+      q.pop_front();
+    }
+  }
+}
+
+/**
+ * @brief Time the rounds of a workload
+ *
+ * @param workload the workload, bound to an allocator
+ * @param reset run after every round, to release a region
+ *
+ * @return rounds per second
+ */
+static double rate(const std::function<void()> & workload, const std::function<void()> & reset) {
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < ROUNDS; i++) {
+    workload();
+    reset();
+  }
+  std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+  return ROUNDS / seconds.count();
+}
+
+template <template <class> class Workload>
+static void run(const char * name) {
+  MyRegionResource region;
+  auto none = [] {};
+  std::pmr::polymorphic_allocator<char> shared(my_malloc_resource());
+  std::pmr::polymorphic_allocator<char> regional(&region);
+
+  printf("%-12s %14.0f %14.0f %14.0f %14.0f\n", name,
+         rate([] { Workload<std::allocator<char>>::run(std::allocator<char>()); }, none),
+         rate([] { Workload<MyAllocator<char>>::run(MyAllocator<char>()); }, none),
+         rate([&] { Workload<std::pmr::polymorphic_allocator<char>>::run(shared); }, none),
+         rate([&] { Workload<std::pmr::polymorphic_allocator<char>>::run(regional); },
+              [&] { region.release(); }));
+}
+
+#define WORKLOAD(fn) \
+  template <class A> \
+  struct fn##_workload { \
+    static void run(const A & alloc) { fn(alloc); } \
+  };
+
+WORKLOAD(arguments)
+WORKLOAD(headers)
+WORKLOAD(connections)
+WORKLOAD(queue)
+
+int main() {
+  printf("%-12s %14s %14s %14s %14s\n", "rounds/s", "std::allocator", "MyAllocator",
+         "pmr my_malloc", "pmr region");
+  run<arguments_workload>("arguments");
+  run<headers_workload>("headers");
+  run<connections_workload>("connections");
+  run<queue_workload>("queue");
+}
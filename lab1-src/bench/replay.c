@@ -0,0 +1,487 @@
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../myMalloc.h"
+
+/*
+ * Replays a trace written by a TRACE build of the allocator (see
+ * MYMALLOC_TRACE) through the C library's allocation functions. Like bench,
+ * it measures glibc when run directly and my_malloc with
+ * LD_PRELOAD=libmymalloc.so, so a captured workload can be rerun against
+ * any allocator
+ *
+ * Block addresses are replaced by dense ids before the replay. With -t the
+ * calls of each traced thread are replayed on one of that many threads, and
+ * a call on a block another thread allocates waits for the allocation
+ *
+ * With -p and LD_PRELOAD=libmymalloc.so the trace is replayed on one thread
+ * once per placement policy, each in a fresh process, to compare the heap
+ * each policy needs for the same calls
+ */
+
+/* Marks an id with no block */
+#define NO_ID UINT32_MAX
+
+/* A call of the trace with its blocks numbered, a realloc is one
+ * TRACE_REALLOC_RESULT op from oldId to id */
+typedef struct replay_op {
+  uint32_t id;
+  uint32_t oldId;
+  uint64_t size;
+  uint32_t thread;
+  uint8_t op;
+  uint8_t alignLog2;
+} replay_op;
+
+typedef struct replayer {
+  pthread_t thread;
+  int index;
+  uint64_t start;
+  uint64_t end;
+} replayer;
+
+/* Open addressing map from a live block's address to its id */
+typedef struct id_map {
+  uint64_t * keys;
+  uint32_t * ids;
+  size_t capacity;
+  size_t count;
+} id_map;
+
+static replay_op * ops;
+static size_t numOps;
+static uint32_t numIds;
+static uint32_t maxThread;
+static int numReplayers = 1;
+
+/* The op after which the most bytes are live */
+static size_t peakOp;
+
+/* my_malloc_stats when comparing policies, the stats just after peakOp */
+static allocator_stats (* statsFn)();
+static allocator_stats peakStats;
+
+/* Values of MYMALLOC_PLACEMENT, indexed by enum placement */
+static const char * const placementNames[PLACEMENT_POLICIES] = { "first", "best", "address", "next" };
+
+/* The block replayed for each id, NULL until it is allocated */
+static void ** blocks;
+
+static pthread_barrier_t startBarrier;
+
+static inline uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static inline size_t map_slot(id_map * m, uint64_t key) {
+  size_t i = (key >> 4) * 0x9E3779B97F4A7C15ULL;
+  return i & (m->capacity - 1);
+}
+
+static void map_put(id_map * m, uint64_t key, uint32_t id);
+
+static void map_grow(id_map * m) {
+  id_map old = *m;
+  m->capacity = old.capacity == 0 ? 1024 : old.capacity * 2;
+  m->keys = calloc(m->capacity, sizeof(uint64_t));
+  m->ids = calloc(m->capacity, sizeof(uint32_t));
+  m->count = 0;
+  for (size_t i = 0; i < old.capacity; i++) {
+    if (old.keys[i] != 0) {
+      map_put(m, old.keys[i], old.ids[i]);
+    }
+  }
+  free(old.keys);
+  free(old.ids);
+}
+
+static void map_put(id_map * m, uint64_t key, uint32_t id) {
+  if ((m->count + 1) * 2 > m->capacity) {
+    map_grow(m);
+  }
+  size_t i = map_slot(m, key);
+  while (m->keys[i] != 0 && m->keys[i] != key) {
+    i = (i + 1) & (m->capacity - 1);
+  }
+  if (m->keys[i] == 0) {
+    m->count++;
+  }
+  m->keys[i] = key;
+  m->ids[i] = id;
+}
+
+/**
+ * @brief Remove a block from the map
+ *
+ * @param m the map
+ * @param key the block's address
+ *
+ * @return the block's id or NO_ID if it was not in the map
+ */
+static uint32_t map_take(id_map * m, uint64_t key) {
+  if (m->capacity == 0) {
+    return NO_ID;
+  }
+  size_t i = map_slot(m, key);
+  while (m->keys[i] != key) {
+    if (m->keys[i] == 0) {
+      return NO_ID;
+    }
+    i = (i + 1) & (m->capacity - 1);
+  }
+  uint32_t id = m->ids[i];
+
+  // Shift later entries of the probe sequence back into the hole
+  size_t hole = i;
+  for (size_t j = (i + 1) & (m->capacity - 1); m->keys[j] != 0; j = (j + 1) & (m->capacity - 1)) {
+    size_t home = map_slot(m, m->keys[j]);
+    if (((j - home) & (m->capacity - 1)) >= ((j - hole) & (m->capacity - 1))) {
+      m->keys[hole] = m->keys[j];
+      m->ids[hole] = m->ids[j];
+      hole = j;
+    }
+  }
+  m->keys[hole] = 0;
+  m->count--;
+  return id;
+}
+
+/**
+ * @brief Read a trace and number its blocks. Frees of blocks allocated
+ *        before tracing started and failed allocations are dropped
+ *
+ * @param path the trace file
+ * @param peak_live set to the most bytes requested and not yet freed at once,
+ *        the op reaching it is recorded in peakOp
+ *
+ * @return false if the file could not be read
+ */
+static bool load_trace(const char * path, uint64_t * peak_live) {
+  FILE * f = fopen(path, "rb");
+  if (f == NULL) {
+    perror(path);
+    return false;
+  }
+  uint64_t fileHeader[3];
+  if (fread(fileHeader, 1, TRACE_HEADER_SIZE, f) != TRACE_HEADER_SIZE ||
+      fileHeader[0] != TRACE_MAGIC || fileHeader[1] != TRACE_VERSION ||
+      fileHeader[2] != sizeof(trace_record)) {
+    fprintf(stderr, "%s: not a trace\n", path);
+    fclose(f);
+    return false;
+  }
+
+  fseek(f, 0, SEEK_END);
+  size_t numRecords = (ftell(f) - TRACE_HEADER_SIZE) / sizeof(trace_record);
+  fseek(f, TRACE_HEADER_SIZE, SEEK_SET);
+  trace_record * records = malloc(numRecords * sizeof(trace_record) + 1);
+  numRecords = fread(records, sizeof(trace_record), numRecords, f);
+  fclose(f);
+
+  for (size_t i = 0; i < numRecords; i++) {
+    maxThread = records[i].thread > maxThread ? records[i].thread : maxThread;
+  }
+
+  // A realloc's old block between its two records, per traced thread
+  uint32_t * pendingId = malloc((maxThread + 1) * sizeof(uint32_t));
+  uint64_t * pendingPtr = calloc(maxThread + 1, sizeof(uint64_t));
+  uint64_t * sizes = NULL;
+  size_t sizesCapacity = 0;
+
+  ops = malloc(numRecords * sizeof(replay_op) + 1);
+  id_map live = { NULL, NULL, 0, 0 };
+  uint64_t liveBytes = 0;
+  *peak_live = 0;
+
+  for (size_t i = 0; i < numRecords; i++) {
+    trace_record * r = &records[i];
+    replay_op op = { NO_ID, NO_ID, r->size, r->thread, r->op, r->alignLog2 };
+
+    switch (r->op) {
+      case TRACE_FREE:
+        op.id = map_take(&live, r->ptr);
+        if (op.id == NO_ID) {
+          continue;
+        }
+        liveBytes -= sizes[op.id];
+        break;
+      case TRACE_REALLOC:
+        pendingId[r->thread] = map_take(&live, r->ptr);
+        pendingPtr[r->thread] = r->ptr;
+        continue;
+      case TRACE_REALLOC_RESULT:
+        op.oldId = pendingId[r->thread];
+        if (r->ptr == 0) {
+          // The old block survives a failed realloc
+          if (op.oldId != NO_ID) {
+            map_put(&live, pendingPtr[r->thread], op.oldId);
+          }
+          continue;
+        }
+        break;
+      case TRACE_MALLOC:
+      case TRACE_CALLOC:
+      case TRACE_MEMALIGN:
+        if (r->ptr == 0) {
+          continue;
+        }
+        break;
+      default:
+        fprintf(stderr, "%s: unknown call %d\n", path, r->op);
+        return false;
+    }
+
+    if (r->op != TRACE_FREE) {
+      op.id = numIds++;
+      map_put(&live, r->ptr, op.id);
+      if (op.id >= sizesCapacity) {
+        sizesCapacity = sizesCapacity == 0 ? 1024 : sizesCapacity * 2;
+        sizes = realloc(sizes, sizesCapacity * sizeof(uint64_t));
+      }
+      sizes[op.id] = r->size;
+      liveBytes += r->size;
+      if (op.oldId != NO_ID) {
+        liveBytes -= sizes[op.oldId];
+      }
+      if (liveBytes > *peak_live) {
+        *peak_live = liveBytes;
+        peakOp = numOps;
+      }
+    }
+    ops[numOps++] = op;
+  }
+
+  free(records);
+  free(pendingId);
+  free(pendingPtr);
+  free(sizes);
+  free(live.keys);
+  free(live.ids);
+  return true;
+}
+
+/**
+ * @brief Wait until a block another thread allocates exists
+ *
+ * @param id the block's id
+ *
+ * @return the block
+ */
+static inline void * wait_for(uint32_t id) {
+  void * p;
+  while ((p = __atomic_load_n(&blocks[id], __ATOMIC_ACQUIRE)) == NULL) {
+    sched_yield();
+  }
+  return p;
+}
+
+static inline void publish(uint32_t id, void * p, uint64_t size) {
+  // Touch the block like the traced program did
+  if (size != 0) {
+    ((char *) p)[0] = 1;
+  }
+  __atomic_store_n(&blocks[id], p, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Replay the calls of the traced threads assigned to one replayer
+ */
+static void * replay(void * arg) {
+  replayer * rp = arg;
+  pthread_barrier_wait(&startBarrier);
+  rp->start = now_ns();
+
+  for (size_t i = 0; i < numOps; i++) {
+    replay_op * op = &ops[i];
+    if ((int) (op->thread % numReplayers) != rp->index) {
+      continue;
+    }
+
+    void * p;
+    switch (op->op) {
+      case TRACE_MALLOC:
+        p = malloc(op->size);
+        break;
+      case TRACE_CALLOC:
+        p = calloc(1, op->size);
+        break;
+      case TRACE_MEMALIGN:
+        p = aligned_alloc((size_t) 1 << op->alignLog2, op->size);
+        break;
+      case TRACE_REALLOC_RESULT:
+        // A realloc of a block from before tracing started becomes a malloc
+        p = op->oldId == NO_ID ? malloc(op->size) : realloc(wait_for(op->oldId), op->size);
+        break;
+      default:
+        free(wait_for(op->id));
+        continue;
+    }
+    if (p == NULL) {
+      fprintf(stderr, "replay: allocation %zu failed\n", i);
+      exit(1);
+    }
+    publish(op->id, p, op->size);
+    if (i == peakOp && statsFn != NULL) {
+      peakStats = statsFn();
+    }
+  }
+  rp->end = now_ns();
+  return NULL;
+}
+
+/**
+ * @brief Read a field of /proc/self/status
+ *
+ * @param field the field's name followed by a colon
+ *
+ * @return its value in KB or -1 if it could not be read
+ */
+static long status_kb(const char * field) {
+  FILE * f = fopen("/proc/self/status", "r");
+  if (f == NULL) {
+    return -1;
+  }
+  char line[256];
+  long kb = -1;
+  while (fgets(line, sizeof(line), f) != NULL) {
+    if (strncmp(line, field, strlen(field)) == 0) {
+      kb = strtol(line + strlen(field), NULL, 10);
+      break;
+    }
+  }
+  fclose(f);
+  return kb;
+}
+
+static void usage(const char * prog) {
+  fprintf(stderr, "usage: %s [-t threads | -p] trace\n", prog);
+  exit(1);
+}
+
+/**
+ * @brief Replay the trace on numReplayers threads
+ *
+ * @return the nanoseconds from the first replayer starting to the last one
+ *         finishing
+ */
+static uint64_t run_replayers() {
+  replayer * replayers = calloc(numReplayers, sizeof(replayer));
+  pthread_barrier_init(&startBarrier, NULL, numReplayers + 1);
+  for (int i = 0; i < numReplayers; i++) {
+    replayers[i].index = i;
+    pthread_create(&replayers[i].thread, NULL, replay, &replayers[i]);
+  }
+  pthread_barrier_wait(&startBarrier);
+  uint64_t start = UINT64_MAX;
+  uint64_t end = 0;
+  for (int i = 0; i < numReplayers; i++) {
+    pthread_join(replayers[i].thread, NULL);
+    start = replayers[i].start < start ? replayers[i].start : start;
+    end = replayers[i].end > end ? replayers[i].end : end;
+  }
+  free(replayers);
+  return end - start;
+}
+
+/**
+ * @brief Replay the trace once per placement policy, each in a child so
+ *        every policy starts from the same heap
+ *
+ * @param prog the program's name for errors
+ * @param peak_live the most bytes live at once in the trace
+ */
+static void compare_policies(const char * prog, uint64_t peak_live) {
+  bool (* setPlacement)(enum placement) = dlsym(RTLD_DEFAULT, "my_malloc_set_placement");
+  statsFn = dlsym(RTLD_DEFAULT, "my_malloc_stats");
+  if (setPlacement == NULL || statsFn == NULL) {
+    fprintf(stderr, "%s: -p needs my_malloc, run it with LD_PRELOAD=libmymalloc.so\n", prog);
+    exit(1);
+  }
+
+  printf("%-9s %10s %14s %13s %13s %9s %14s\n", "placement", "calls", "calls/s",
+         "peak live KB", "peak heap KB", "overhead", "fragmentation");
+  for (int i = 0; i < PLACEMENT_POLICIES; i++) {
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+      setPlacement(i);
+      // The heap already holds the trace, only its growth is the replay's
+      size_t startBytes = statsFn().osBytes;
+      uint64_t nanos = run_replayers();
+      size_t heapBytes = statsFn().peakOsBytes - startBytes;
+      printf("%-9s %10zu %14.0f %13lu %13zu %9.2f %14.4f\n", placementNames[i], numOps,
+             numOps / (nanos / 1e9), (unsigned long) (peak_live / 1024), heapBytes / 1024,
+             peak_live == 0 ? 0 : (double) heapBytes / peak_live, peakStats.fragmentation);
+      exit(0);
+    }
+    waitpid(pid, NULL, 0);
+  }
+}
+
+int main(int argc, char ** argv) {
+  int opt;
+  bool policies = false;
+  while ((opt = getopt(argc, argv, "t:p")) != -1) {
+    switch (opt) {
+      case 't':
+        numReplayers = atoi(optarg);
+        break;
+      case 'p':
+        policies = true;
+        break;
+      default:
+        usage(argv[0]);
+    }
+  }
+  if (optind != argc - 1 || numReplayers < 1 || (policies && numReplayers != 1)) {
+    usage(argv[0]);
+  }
+
+  const char * allocatorName = "glibc";
+  const char * preload = getenv("LD_PRELOAD");
+  if (preload != NULL && preload[0] != '\0') {
+    const char * slash = strrchr(preload, '/');
+    allocatorName = slash != NULL ? slash + 1 : preload;
+  }
+
+  uint64_t peakLive;
+  if (!load_trace(argv[optind], &peakLive)) {
+    return 1;
+  }
+  blocks = calloc(numIds + 1, sizeof(void *));
+
+  if (policies) {
+    compare_policies(argv[0], peakLive);
+    return 0;
+  }
+
+  // Reset the peak RSS so memory used while loading the trace is not counted
+  FILE * clearRefs = fopen("/proc/self/clear_refs", "w");
+  if (clearRefs != NULL) {
+    fputs("5", clearRefs);
+    fclose(clearRefs);
+  }
+  long startRss = status_kb("VmRSS:");
+
+  uint64_t nanos = run_replayers();
+
+  long growth = status_kb("VmHWM:") - startRss;
+  printf("%-14s %7s %10s %14s %13s %15s %9s\n", "allocator", "threads", "calls",
+         "calls/s", "peak live KB", "RSS growth KB", "overhead");
+  printf("%-14s %7d %10zu %14.0f %13lu %15ld %9.2f\n", allocatorName, numReplayers,
+         numOps, numOps / (nanos / 1e9), (unsigned long) (peakLive / 1024), growth,
+         peakLive == 0 ? 0 : growth * 1024.0 / peakLive);
+}
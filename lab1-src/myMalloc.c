@@ -1,35 +1,475 @@
+#define _GNU_SOURCE
+
 #include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
 #include <pthread.h>
+#include <signal.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
+#include <sys/mman.h>
 #include <assert.h>
 #include <stdbool.h>
 
 #include "myMalloc.h"
 
 #define MALLOC_COLOR "MALLOC_DEBUG_COLOR"
+#define MALLOC_MMAP_THRESHOLD "MYMALLOC_MMAP_THRESHOLD"
+#define MALLOC_GROW_MIN "MYMALLOC_GROW_MIN"
+#define MALLOC_GROW_FACTOR "MYMALLOC_GROW_FACTOR"
+#define MALLOC_GROW_MAX "MYMALLOC_GROW_MAX"
+#define MALLOC_GROW_RESERVE "MYMALLOC_GROW_RESERVE"
+#define MALLOC_TRIM_THRESHOLD "MYMALLOC_TRIM_THRESHOLD"
+#define MALLOC_TRACE "MYMALLOC_TRACE"
+#define MALLOC_HUGE_PAGES "MYMALLOC_HUGE_PAGES"
+#define MALLOC_PREFAULT "MYMALLOC_PREFAULT"
+#define MALLOC_GUARD_SAMPLE_RATE "MYMALLOC_GUARD_SAMPLE_RATE"
+#define MALLOC_PLACEMENT "MYMALLOC_PLACEMENT"
+#define MALLOC_COMPACT_FRAGMENTATION "MYMALLOC_COMPACT_FRAGMENTATION"
+#define MALLOC_STATS_SIGNAL "MYMALLOC_STATS_SIGNAL"
 
 static bool check_env;
 static bool use_color;
 
+#if THREAD_CACHE_SIZE > 0
+/*
+ * Per-thread cache of recently freed small blocks binned by free list index.
+ * Cached blocks stay marked as allocated in the boundary tags so they are
+ * never coalesced, and are chained together through their next pointer
+ */
+typedef struct thread_cache {
+  header * bins[N_LISTS - 1];
+  size_t counts[N_LISTS - 1];
+} thread_cache;
+
+static __thread thread_cache tcache;
+static __thread bool tcache_registered;
+
+/*
+ * Key whose destructor returns a thread's cache to the free lists when the
+ * thread exits. Its address is also stored in the prev pointer of cached
+ * blocks to detect double frees
+ */
+static pthread_key_t tcache_key;
+#endif
+
+#if SLAB_MAX_SIZE > 0
+/* One slab size class per multiple of 8 bytes up to SLAB_MAX_SIZE */
+#define SLAB_CLASSES (SLAB_MAX_SIZE / 8)
+
+_Static_assert(SLAB_MAX_SIZE % MIN_ALIGNMENT == 0, "SLAB_MAX_SIZE must be a multiple of MIN_ALIGNMENT");
+
+/* Enough bitmap words for a slab of the smallest slots */
+#define SLAB_MAP_WORDS (SLAB_PAGE_SIZE / 8 / 64)
+
+/*
+ * A slab is a SLAB_PAGE_SIZE aligned page carved into equal sized slots
+ * for small objects. Bit i of freeMap is set while slot i is free, hint is
+ * the first word of freeMap that may have a free slot
+ */
+typedef struct slab {
+  struct slab * next;
+  struct slab * prev;
+  uint32_t slotSize;
+  uint32_t nslots;
+  uint32_t nfree;
+  uint32_t hint;
+  uint64_t freeMap[SLAB_MAP_WORDS];
+} slab;
+
+/* Offset of the first slot in a slab */
+#define SLAB_HEADER_SIZE ((sizeof(slab) + 15) & ~(size_t) 15)
+
+/*
+ * The slabs of one size class that have at least one free slot
+ */
+typedef struct slab_class {
+  pthread_mutex_t mutex;
+  slab * partial;
+} slab_class;
+
+static slab_class slabClasses[SLAB_CLASSES];
+
+/*
+ * Slabs are carved from a single reserved region and recorded in the chunk
+ * map while in use. Empty slabs are kept on freeSlabs for reuse
+ */
+static pthread_mutex_t slabPoolMutex = PTHREAD_MUTEX_INITIALIZER;
+static char * slabRegion;
+static char * slabRegionTop;
+static slab * freeSlabs;
+#endif
+
+/*
+ * Sampled blocks are guarded in a pool of pages alternating between
+ * inaccessible guard pages and slots, so slot i is page 2 * i + 1 of the
+ * pool. A slot holds one block at the end of its page and is inaccessible
+ * again once the block is freed. Freed slots wait in guardQueue so the one
+ * freed longest ago is reused first
+ */
+typedef enum {
+  GUARD_UNUSED,
+  GUARD_ALLOCATED,
+  GUARD_FREED,
+} guard_state;
+
+typedef struct guard_slot {
+  char * mem;
+  size_t size;
+  guard_state state;
+} guard_slot;
+
+static size_t guardSampleRate = GUARD_SAMPLE_RATE;
+static pthread_mutex_t guardMutex = PTHREAD_MUTEX_INITIALIZER;
+static char * guardPool;
+static char * guardPoolEnd;
+static size_t guardPageSize;
+static guard_slot guardSlots[GUARD_SLOTS];
+static size_t guardFresh;
+static size_t guardQueue[GUARD_SLOTS];
+static size_t guardQueueHead;
+static size_t guardQueueCount;
+static struct sigaction guardOldAction;
+
+/*
+ * Allocations this thread makes before its next guarded one, 0 before its
+ * first allocation
+ */
+static __thread size_t guardCountdown;
+static __thread uint64_t guardRandom;
+
+/* Lists past the exact size classes, each covering a range of sizes */
+#define GEOMETRIC_CLASSES (N_LISTS - 1 - SIZE_CLASS_EXACT_MAX / 8)
+
+/* Entries covering every size past the header up to the last geometric class */
+#define SIZE_CLASS_TABLE_ENTRIES (((SIZE_CLASS_EXACT_MAX << \
+    ((GEOMETRIC_CLASSES + SIZE_CLASS_STEPS - 1) / SIZE_CLASS_STEPS)) + 16 * N_LISTS) / 8 + 1)
+
+_Static_assert(SIZE_CLASS_EXACT_MAX % 8 == 0 && SIZE_CLASS_EXACT_MAX >= 8,
+               "SIZE_CLASS_EXACT_MAX must be a positive multiple of 8");
+_Static_assert(GEOMETRIC_CLASSES >= 0, "SIZE_CLASS_EXACT_MAX needs more lists than N_LISTS");
+_Static_assert((GEOMETRIC_CLASSES + SIZE_CLASS_STEPS - 1) / SIZE_CLASS_STEPS <= 12,
+               "geometric size classes span too many doublings for the size class table");
+_Static_assert(N_LISTS <= 256, "size class table entries hold list indices in a byte");
+_Static_assert(MIN_ALIGNMENT == 8 || MIN_ALIGNMENT == 16, "MIN_ALIGNMENT must be 8 or 16");
+
+/*
+ * Free lists for each size past the header in steps of 8, built once by
+ * size_classes_init. block is the list a free block of that size goes in,
+ * request the first list whose every block fits a request of that size
+ */
+typedef struct size_class {
+  uint8_t block;
+  uint8_t request;
+} size_class;
+
+static size_class sizeClassTable[SIZE_CLASS_TABLE_ENTRIES];
+
+/* Largest size past the header below the final list */
+static size_t sizeClassMax;
+
+/* Smallest size past the header each list holds */
+static size_t sizeClassFirst[N_LISTS];
+
+/* Number of 64 bit words needed for one bit per free list */
+#define FREELIST_BITMAP_WORDS ((N_LISTS + 63) / 64)
+
+#if COMPACT_HEADERS
+/* Free list link naming the sentinel of a list rather than a block */
+#define SENTINEL_LINK(idx) (INT32_MIN + (idx))
+
+/*
+ * Bytes an arena's chunks may lie from its first chunk, so every link
+ * between two of its blocks fits in 32 bits without clashing with the
+ * sentinel links
+ */
+#define LINK_REACH ((ptrdiff_t) ((INT32_MAX - N_LISTS) / 2) * 8)
+#endif
+
+/*
+ * The chunk map records what each 4KB page of the address space holds, so
+ * the owner of any pointer is found with two loads. The root is indexed by
+ * the top bits of the page number and points to leaves mapped on first use.
+ * An entry holds a chunk_kind in its low CHUNK_KIND_BITS and above them the
+ * index of the owning arena or the slot size of a slab in 8 byte units
+ */
+#define CHUNK_MAP_PAGE_SHIFT 12
+#define CHUNK_MAP_ADDRESS_BITS 48
+#define CHUNK_MAP_LEAF_BITS 20
+#define CHUNK_MAP_ROOT_BITS (CHUNK_MAP_ADDRESS_BITS - CHUNK_MAP_PAGE_SHIFT - CHUNK_MAP_LEAF_BITS)
+#define CHUNK_KIND_BITS 3
+
+typedef enum {
+  CHUNK_NONE,
+  CHUNK_ARENA,
+  CHUNK_MMAPPED,
+  CHUNK_SLAB,
+  CHUNK_GUARD,
+} chunk_kind;
+
+typedef struct chunk_map_leaf {
+  uint16_t entries[1 << CHUNK_MAP_LEAF_BITS];
+} chunk_map_leaf;
+
+static chunk_map_leaf * chunkMap[1 << CHUNK_MAP_ROOT_BITS];
+
+/*
+ * An arena is an independent heap with its own free lists, chunks from the
+ * OS and lock. The main arena grows with sbrk while the others carve their
+ * chunks out of ARENA_HEAP_SIZE aligned heaps from mmap. The chunk map
+ * records the arena owning each page of its chunks
+ */
+typedef struct arena {
+  // Mutex to ensure thread safety for the freelist
+  pthread_mutex_t mutex;
+
+  // Array of sentinel nodes for the freelists
+  header freelistSentinels[N_LISTS];
+
+  // Bit i is set when free list i is not empty
+  uint64_t freelistBitmap[FREELIST_BITMAP_WORDS];
+
+#if FINAL_LIST_TREE
+  // Root of the tree of blocks in the final free list
+  header * freeTree;
+#endif
+
+  // The free block the last next fit allocation was split from, moved on to
+  // its successor when it leaves its list
+  header * rover;
+
+  // Pointer to the second fencepost in the most recently allocated chunk
+  // from the OS. Used for coalescing chunks
+  header * lastFencePost;
+
+  // List of chunks allocated by the OS for printing boundary tags, in the
+  // order they were added. Grown with mmap as it fills
+  header ** osChunkList;
+  size_t numOsChunks;
+  size_t osChunkCapacity;
+
+  // The heap new chunks are carved from (unused by the main arena)
+  struct arena_heap * heap;
+
+  // The size of the next chunk requested from the OS
+  size_t growSize;
+
+#if REMOTE_FREE
+  // Blocks freed by threads using other arenas, chained through their next
+  // pointers and still marked allocated until the arena frees them
+  header * remoteFree;
+#endif
+
+  // Counters reported by my_malloc_stats
+  size_t inUseBytes;
+  size_t osBytes;
+  size_t peakOsBytes;
+  size_t osChunks;
+  uint64_t lockWaitNanos;
+
+  bool initialized;
+} arena;
+
 /*
- * Mutex to ensure thread safety for the freelist
+ * Metadata at the start of each heap mapped for a secondary arena
  */
-static pthread_mutex_t mutex;
+typedef struct arena_heap {
+  char * top;
+  char * end;
+  // The size of the pages backing the heap, which are released whole
+  size_t pageSize;
+} arena_heap;
+
+/* Space reserved for the metadata at the start of a secondary arena's heap */
+#define ARENA_HEAP_HEADER_SIZE ((sizeof(arena_heap) + 15) & ~(size_t) 15)
+
+static arena arenas[N_ARENAS];
+static arena * const main_arena = &arenas[0];
+
+/*
+ * The end of the memory the main arena has received from sbrk, to tell
+ * whether anyone else moved the break since
+ */
+static char * mainHeapEnd;
+
+/*
+ * The arena each thread allocates from. Threads are assigned round robin
+ * and move to another arena when theirs is contended
+ */
+static __thread arena * thread_arena;
+static size_t nextArena;
+
+/*
+ * Requests of at least this many bytes get their own mapping from mmap,
+ * 0 disables the mmap path
+ */
+static size_t mmapThreshold = MMAP_THRESHOLD;
+
+/* Bytes in blocks with their own mapping */
+static size_t mmappedBytes;
+
+#if STATS
+/*
+ * Blocks handed out and taken back counted per size class. Each thread
+ * counts into a block of its own, which is never unmapped and is handed to
+ * a new thread once its owner exits, so the blocks can be summed without a
+ * lock
+ */
+typedef struct call_counters {
+  size_t mallocs[N_LISTS];
+  size_t frees[N_LISTS];
+  // Every block ever mapped
+  struct call_counters * next;
+  // Blocks of exited threads, guarded by countersMutex
+  struct call_counters * nextIdle;
+} call_counters;
+
+static call_counters * allCounters;
+static call_counters * idleCounters;
+static pthread_mutex_t countersMutex = PTHREAD_MUTEX_INITIALIZER;
+static __thread call_counters * threadCounters;
+
+/* Key whose destructor returns a thread's counters when the thread exits */
+static pthread_key_t countersKey;
+#endif // STATS
+
+/* The descriptor my_malloc_stats_on_signal writes to */
+static int statsSignalFd = -1;
+
+/*
+ * Free blocks of at least this many bytes return their pages to the OS,
+ * 0 leaves that to my_malloc_trim
+ */
+static size_t trimThreshold = TRIM_THRESHOLD;
+
+/* The enum placement allocate_object uses, changed at any time */
+static int placement = PLACEMENT;
+
+/* Values of MYMALLOC_PLACEMENT, indexed by enum placement */
+static const char * const placementNames[PLACEMENT_POLICIES] = { "first", "best", "address", "next" };
+
+/* Values of hugePages */
+#define HUGE_PAGES_OFF 0
+#define HUGE_PAGES_TRANSPARENT 1
+#define HUGE_PAGES_EXPLICIT 2
+
+#ifndef MAP_FIXED_NOREPLACE
+// Older C libraries lack the flag, the address is then only a hint
+#define MAP_FIXED_NOREPLACE 0
+#endif
+
+/*
+ * Whether arena memory is backed by huge pages and whether it is faulted in
+ * as the arenas take it
+ */
+static size_t hugePages = HUGE_PAGES;
+static size_t prefault = PREFAULT;
+
+#if TRACE
+/* Records buffered before being written out, a power of two */
+#define TRACE_RING_SIZE 65536
+
+/* Records are written out half a ring at a time */
+#define TRACE_FLUSH_SIZE (TRACE_RING_SIZE / 2)
+
+/*
+ * Trace records are numbered in call order and buffered in a ring. The slot
+ * of record n holds n + 1 in traceCommitted once the record is complete. The
+ * thread that takes the first record of each half of the ring writes out the
+ * other half, traceFlushed counts the records written out
+ */
+static int traceFd = -1;
+static uint64_t traceStart;
+static uint64_t traceNext;
+static uint64_t traceFlushed;
+static trace_record traceRing[TRACE_RING_SIZE];
+static uint64_t traceCommitted[TRACE_RING_SIZE];
+
+static uint32_t traceThreads;
+static __thread uint32_t traceThread;
+#endif
+
+/*
+ * A block a region allocates from. Blocks of REGION_BLOCK_SIZE are chained
+ * in the order the region fills them and kept when it is reset, larger
+ * ones hold a single allocation and are freed by a reset
+ */
+typedef struct region_block {
+  struct region_block * next;
+  char data[] __attribute__ ((aligned (MIN_ALIGNMENT)));
+} region_block;
+
+/*
+ * top and end bound the free space in current, the block being filled.
+ * current is NULL before the first block is filled
+ */
+struct my_region {
+  region_block * first;
+  region_block * current;
+  char * top;
+  char * end;
+  region_block * large;
+};
+
+/*
+ * An entry of the handle table. A handle's object lives in an arena block
+ * after HANDLE_PREFIX bytes whose first word points back to the entry, so
+ * the compactor can tell it from other blocks as it walks a chunk
+ */
+struct my_handle_entry {
+  void * mem;
+  union {
+    // Outstanding my_hlock calls while the entry is in use
+    size_t locks;
+    // The next unused entry otherwise
+    struct my_handle_entry * nextFree;
+  };
+};
+
+#define HANDLE_PREFIX MIN_ALIGNMENT
+
+/* Handles freed between checks of their arena's fragmentation */
+#define COMPACT_CHECK_INTERVAL 64
+
+/*
+ * The handle table, its entries handed out so far and the unused ones
+ * among them. handleMutex guards the table and the handles' objects while
+ * they move, and is taken before any arena lock
+ */
+static pthread_mutex_t handleMutex = PTHREAD_MUTEX_INITIALIZER;
+static struct my_handle_entry * handleTable;
+static size_t handleTop;
+static struct my_handle_entry * handleFreeList;
+static size_t handleFrees;
+static size_t compactFragmentation = COMPACT_FRAGMENTATION;
 
 /*
- * Array of sentinel nodes for the freelists
+ * Chunk growth policy. Chunks start at growMin bytes and each arena's chunk
+ * size is multiplied by growFactor after every chunk until it reaches
+ * growMax. A request larger than the current chunk size gets a chunk sized
+ * to fit it. When growReserve is set the main arena commits its chunks from
+ * a region of that many bytes reserved up front instead of using sbrk
  */
-header freelistSentinels[N_LISTS];
+static size_t growMin = ARENA_SIZE;
+static size_t growFactor = GROW_FACTOR;
+static size_t growMax = GROW_MAX;
+static size_t growReserve = GROW_RESERVE;
 
 /*
- * Pointer to the second fencepost in the most recently allocated chunk from
- * the OS. Used for coalescing chunks
+ * The reserved region of the main arena: memory below reserveTop is in use,
+ * memory below reserveCommitted is readable and writable
  */
-header * lastFencePost;
+static char * reserveBase;
+static char * reserveTop;
+static char * reserveCommitted;
+
+/* The size of the pages backing the reserved region */
+static size_t reservePageSize;
 
 /*
  * Pointer to maintian the base of the heap to allow printing based on the
@@ -37,12 +477,6 @@ header * lastFencePost;
  */ 
 void * base;
 
-/*
- * List of chunks allocated by  the OS for printing boundary tags
- */
-header * osChunkList [MAX_OS_CHUNKS];
-size_t numOsChunks = 0;
-
 /*
  * direct the compiler to run the init function before running main
  * this allows initialization of required globals
@@ -52,31 +486,44 @@ static void init (void) __attribute__ ((constructor));
 // Helper functions for manipulating pointers to headers
 static inline header * get_header_from_offset(void * ptr, ptrdiff_t off);
 static inline header * get_left_header(header * h);
+static inline bool left_is_free(header * h);
+static inline void set_left_size(header * h, header * left);
 static inline header * ptr_to_header(void * p);
 
 // Helper functions for allocating more memory from the OS
 static inline void initialize_fencepost(header * fp, size_t left_size);
-static inline void insert_os_chunk(header * hdr);
+static inline void insert_os_chunk(arena * a, header * hdr);
 static inline void insert_fenceposts(void * raw_mem, size_t size);
-static header * allocate_chunk(size_t size);
+static void * arena_morecore(arena * a, size_t size);
+static bool arena_lesscore(arena * a, char * new_end, char * end);
+static header * allocate_chunk(arena * a, size_t size);
+
+// Helper functions for choosing and locking an arena
+static inline void arena_acquire(arena * a);
+static arena * arena_lock();
+static inline arena * arena_for_ptr(void * p);
+static inline void remote_free_drain(arena * a);
 
 // Helper functions for freeing a block
-static inline void deallocate_object(void * p);
+static inline void deallocate_object(arena * a, void * p);
 
 // Helper functions for allocating a block
-static inline header * allocate_object(size_t raw_size);
+static inline header * allocate_object(arena * a, size_t raw_size);
 
 // Helper functions for verifying that the data structures are structurally 
 // valid
-static inline header * detect_cycles();
-static inline header * verify_pointers();
+static inline header * detect_cycles(arena * a);
+static inline header * verify_pointers(arena * a);
 static inline bool verify_freelist();
 static inline header * verify_chunk(header * chunk);
 static inline bool verify_tags();
 
 static void init();
+static void init_allocator();
+static inline void ensure_init();
 
 static bool isMallocInitialized;
+static pthread_once_t initOnce = PTHREAD_ONCE_INIT;
 
 /**
  * @brief Helper function to retrieve a header pointer from a pointer and an 
@@ -113,6 +560,43 @@ inline static header * get_left_header(header * h) {
   return get_header_from_offset(h, -h->left_size);
 }
 
+/**
+ * @brief Helper function to check if the block to the left of a given header
+ *        is free, which must hold before its left_size is used
+ *
+ * @param h original header
+ *
+ * @return true if the block to the left of h is free
+ */
+inline static bool left_is_free(header * h) {
+#if COMPACT_HEADERS
+  return h->size_state & LEFT_FREE;
+#else
+  return get_state(get_left_header(h)) == UNALLOCATED;
+#endif
+}
+
+/**
+ * @brief Helper function to record the block to the left of a header once
+ *        that block's size and state are final
+ *
+ * @param h the header to update
+ * @param left the block to the left of h
+ */
+inline static void set_left_size(header * h, header * left) {
+#if COMPACT_HEADERS
+  // Right of an allocated block left_size is the end of that block's data
+  if (get_state(left) == UNALLOCATED) {
+    h->left_size = get_size(left);
+    h->size_state |= LEFT_FREE;
+  } else {
+    h->size_state &= ~LEFT_FREE;
+  }
+#else
+  h->left_size = get_size(left);
+#endif
+}
+
 /**
  * @brief Fenceposts are marked as always allocated and may need to have
  * a left object size to ensure coalescing happens properly
@@ -126,15 +610,114 @@ inline static void initialize_fencepost(header * fp, size_t left_size) {
 	fp->left_size = left_size;
 }
 
+/**
+ * @brief Look up the chunk map entry of the page holding a pointer
+ *
+ * @param p any pointer
+ *
+ * @return the entry, CHUNK_NONE if the allocator does not own the page
+ */
+static inline uint16_t chunk_map_get(void * p) {
+  uintptr_t page = (uintptr_t) p >> CHUNK_MAP_PAGE_SHIFT;
+  if (page >> (CHUNK_MAP_ROOT_BITS + CHUNK_MAP_LEAF_BITS) != 0) {
+    return CHUNK_NONE;
+  }
+  chunk_map_leaf * leaf = __atomic_load_n(&chunkMap[page >> CHUNK_MAP_LEAF_BITS], __ATOMIC_ACQUIRE);
+  if (leaf == NULL) {
+    return CHUNK_NONE;
+  }
+  return __atomic_load_n(&leaf->entries[page & ((1 << CHUNK_MAP_LEAF_BITS) - 1)], __ATOMIC_RELAXED);
+}
+
+static inline chunk_kind chunk_entry_kind(uint16_t entry) {
+  return entry & ((1 << CHUNK_KIND_BITS) - 1);
+}
+
+static inline size_t chunk_entry_id(uint16_t entry) {
+  return entry >> CHUNK_KIND_BITS;
+}
+
+/**
+ * @brief Record what the pages overlapping a range hold in the chunk map.
+ *        Ranges of different owners only share pages with memory the
+ *        allocator does not own
+ *
+ * @param mem the start of the range
+ * @param size the size of the range, not 0
+ * @param kind what the range holds, CHUNK_NONE to forget it
+ * @param id the owning arena or the slot size of a slab in 8 byte units
+ *
+ * @return false, leaving the map unchanged, if a leaf could not be mapped
+ */
+static bool chunk_map_set(void * mem, size_t size, chunk_kind kind, size_t id) {
+  uintptr_t first = (uintptr_t) mem >> CHUNK_MAP_PAGE_SHIFT;
+  uintptr_t last = ((uintptr_t) mem + size - 1) >> CHUNK_MAP_PAGE_SHIFT;
+  if (last >> (CHUNK_MAP_ROOT_BITS + CHUNK_MAP_LEAF_BITS) != 0) {
+    return false;
+  }
+
+  // Map every leaf needed before writing any entry
+  for (uintptr_t i = first >> CHUNK_MAP_LEAF_BITS; i <= last >> CHUNK_MAP_LEAF_BITS; i++) {
+    if (__atomic_load_n(&chunkMap[i], __ATOMIC_ACQUIRE) != NULL) {
+      continue;
+    }
+    chunk_map_leaf * leaf = mmap(NULL, sizeof(chunk_map_leaf), PROT_READ | PROT_WRITE,
+                                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (leaf == MAP_FAILED) {
+      return false;
+    }
+    chunk_map_leaf * expected = NULL;
+    if (!__atomic_compare_exchange_n(&chunkMap[i], &expected, leaf, false,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+      munmap(leaf, sizeof(chunk_map_leaf));
+    }
+  }
+
+  uint16_t entry = kind | id << CHUNK_KIND_BITS;
+  for (uintptr_t page = first; page <= last; page++) {
+    chunk_map_leaf * leaf = chunkMap[page >> CHUNK_MAP_LEAF_BITS];
+    __atomic_store_n(&leaf->entries[page & ((1 << CHUNK_MAP_LEAF_BITS) - 1)], entry, __ATOMIC_RELAXED);
+  }
+  return true;
+}
+
+/**
+ * @brief Forget the pages an arena no longer uses after its memory shrank
+ *
+ * @param new_end the new end of the arena's memory
+ * @param end the old end
+ */
+static void chunk_map_shrink(char * new_end, char * end) {
+  uintptr_t page = (uintptr_t) 1 << CHUNK_MAP_PAGE_SHIFT;
+  uintptr_t start = ((uintptr_t) new_end + page - 1) & ~(page - 1);
+  if (start < (uintptr_t) end) {
+    chunk_map_set((void *) start, (uintptr_t) end - start, CHUNK_NONE, 0);
+  }
+}
+
 /**
  * @brief Helper function to maintain list of chunks from the OS for debugging
  *
+ * @param a the arena the chunk belongs to
  * @param hdr the first fencepost in the chunk allocated by the OS
  */
-inline static void insert_os_chunk(header * hdr) {
-  if (numOsChunks < MAX_OS_CHUNKS) {
-    osChunkList[numOsChunks++] = hdr;
+inline static void insert_os_chunk(arena * a, header * hdr) {
+  if (a->numOsChunks == a->osChunkCapacity) {
+    size_t capacity = a->osChunkCapacity == 0 ? getpagesize() / sizeof(header *)
+                                              : 2 * a->osChunkCapacity;
+    header ** list = mmap(NULL, capacity * sizeof(header *), PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (list == MAP_FAILED) {
+      return;
+    }
+    if (a->osChunkList != NULL) {
+      memcpy(list, a->osChunkList, a->numOsChunks * sizeof(header *));
+      munmap(a->osChunkList, a->osChunkCapacity * sizeof(header *));
+    }
+    a->osChunkList = list;
+    a->osChunkCapacity = capacity;
   }
+  a->osChunkList[a->numOsChunks++] = hdr;
 }
 
 /**
@@ -153,463 +736,3605 @@ inline static void insert_fenceposts(void * raw_mem, size_t size) {
   header * leftFencePost = (header *) mem;
   initialize_fencepost(leftFencePost, ALLOC_HEADER_SIZE);
 
-  // Insert a fencepost at the right edge of the block
-  header * rightFencePost = get_header_from_offset(mem, size - ALLOC_HEADER_SIZE);
-  initialize_fencepost(rightFencePost, size - 2 * ALLOC_HEADER_SIZE);
+  // Insert a fencepost at the right edge of the block
+  header * rightFencePost = get_header_from_offset(mem, size - ALLOC_HEADER_SIZE);
+  initialize_fencepost(rightFencePost, size - 2 * ALLOC_HEADER_SIZE);
+}
+
+/**
+ * @brief Advise the kernel to back the whole pages in a range of arena
+ *        memory with transparent huge pages when huge pages are enabled
+ *
+ * @param mem the start of the range
+ * @param size the size of the range
+ */
+static void advise_huge_pages(void * mem, size_t size) {
+  if (hugePages == HUGE_PAGES_OFF) {
+    return;
+  }
+  size_t page = getpagesize();
+  uintptr_t start = ((uintptr_t) mem + page - 1) & ~(uintptr_t) (page - 1);
+  uintptr_t end = ((uintptr_t) mem + size) & ~(uintptr_t) (page - 1);
+  if (start < end) {
+    madvise((void *) start, end - start, MADV_HUGEPAGE);
+  }
+}
+
+/**
+ * @brief Fault in the whole pages in a range of memory an arena takes when
+ *        prefaulting is enabled
+ *
+ * @param mem the start of the range
+ * @param size the size of the range
+ */
+static void prefault_range(void * mem, size_t size) {
+  if (!prefault) {
+    return;
+  }
+  size_t page = getpagesize();
+  char * start = (char *) (((uintptr_t) mem + page - 1) & ~(uintptr_t) (page - 1));
+  char * end = (char *) (((uintptr_t) mem + size) & ~(uintptr_t) (page - 1));
+  if (start >= end) {
+    return;
+  }
+#ifdef MADV_POPULATE_WRITE
+  if (madvise(start, end - start, MADV_POPULATE_WRITE) == 0) {
+    return;
+  }
+#endif
+  // Kernels without MADV_POPULATE_WRITE fault each page in with a write
+  for (char * p = start; p < end; p += page) {
+    *(volatile char *) p = *(volatile char *) p;
+  }
+}
+
+/**
+ * @brief Map an aligned region of normal pages, advised to use transparent
+ *        huge pages when huge pages are enabled
+ *
+ * @param size the size of the region
+ * @param alignment the power of two the region is aligned to, at least a
+ *        page
+ * @param prot the protection of the region
+ *
+ * @return the region or NULL if the mapping failed
+ */
+static char * map_aligned(size_t size, size_t alignment, int prot) {
+  // Map enough that an aligned region fits and unmap the excess
+  size_t map_size = size + alignment;
+  char * raw = mmap(NULL, map_size, prot, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (raw == MAP_FAILED) {
+    return NULL;
+  }
+
+  char * aligned = (char *) (((uintptr_t) raw + alignment - 1) & ~(uintptr_t) (alignment - 1));
+  if (aligned != raw) {
+    munmap(raw, aligned - raw);
+  }
+  munmap(aligned + size, raw + map_size - (aligned + size));
+  advise_huge_pages(aligned, size);
+  return aligned;
+}
+
+/**
+ * @brief Map an aligned region from the huge page pool. The pool's pages
+ *        are reserved by the mapping, so it fails rather than faults when
+ *        the pool is too small
+ *
+ * @param size the size of the region, a multiple of HUGE_PAGE_SIZE
+ * @param alignment the power of two the region is aligned to, at least
+ *        HUGE_PAGE_SIZE
+ *
+ * @return the region or NULL if the pool cannot supply it
+ */
+static char * map_huge_pages(size_t size, size_t alignment) {
+  // Find an aligned address with a normal reservation, then map the huge
+  // pages there unless another thread took the address in the meantime
+  char * raw = mmap(NULL, size + alignment, PROT_NONE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (raw == MAP_FAILED) {
+    return NULL;
+  }
+  char * aligned = (char *) (((uintptr_t) raw + alignment - 1) & ~(uintptr_t) (alignment - 1));
+  munmap(raw, size + alignment);
+
+  char * mem = mmap(aligned, size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_FIXED_NOREPLACE, -1, 0);
+  if (mem == MAP_FAILED) {
+    return NULL;
+  }
+  // Kernels without MAP_FIXED_NOREPLACE take the address as a hint
+  if (mem != aligned) {
+    munmap(mem, size);
+    return NULL;
+  }
+  return mem;
+}
+
+/**
+ * @brief Map a new ARENA_HEAP_SIZE aligned heap for a secondary arena
+ *
+ * @return the new heap or NULL if the mapping failed
+ */
+static arena_heap * new_arena_heap() {
+  char * aligned = NULL;
+  if (hugePages == HUGE_PAGES_EXPLICIT && ARENA_HEAP_SIZE % HUGE_PAGE_SIZE == 0) {
+    aligned = map_huge_pages(ARENA_HEAP_SIZE, ARENA_HEAP_SIZE);
+  }
+  bool huge = aligned != NULL;
+  if (aligned == NULL) {
+    aligned = map_aligned(ARENA_HEAP_SIZE, ARENA_HEAP_SIZE, PROT_READ | PROT_WRITE);
+  }
+  if (aligned == NULL) {
+    return NULL;
+  }
+
+  arena_heap * heap = (arena_heap *) aligned;
+  heap->top = aligned + ARENA_HEAP_HEADER_SIZE;
+  heap->end = aligned + ARENA_HEAP_SIZE;
+  heap->pageSize = huge ? HUGE_PAGE_SIZE : (size_t) getpagesize();
+  return heap;
+}
+
+/**
+ * @brief Take memory for the main arena from its reserved region, making
+ *        more of the region accessible as needed
+ *
+ * @param size the number of bytes needed
+ *
+ * @return the new memory or NULL if the region is exhausted
+ */
+static void * reserve_commit(size_t size) {
+  if (reserveBase == NULL) {
+    // Huge pages are mapped accessible, so the whole region is committed
+    if (hugePages == HUGE_PAGES_EXPLICIT) {
+      growReserve = (growReserve + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+      char * mem = map_huge_pages(growReserve, HUGE_PAGE_SIZE);
+      if (mem != NULL) {
+        reserveBase = reserveTop = mem;
+        reserveCommitted = mem + growReserve;
+        reservePageSize = HUGE_PAGE_SIZE;
+      }
+    }
+    if (reserveBase == NULL) {
+      size_t alignment = hugePages != HUGE_PAGES_OFF ? HUGE_PAGE_SIZE : (size_t) getpagesize();
+      char * mem = map_aligned(growReserve, alignment, PROT_NONE);
+      if (mem == NULL) {
+        return NULL;
+      }
+      reserveBase = reserveTop = reserveCommitted = mem;
+      reservePageSize = getpagesize();
+    }
+  }
+
+  if ((size_t) (reserveBase + growReserve - reserveTop) < size) {
+    return NULL;
+  }
+
+  if (reserveTop + size > reserveCommitted) {
+    size_t page = getpagesize();
+    char * end = (char *) (((uintptr_t) reserveTop + size + page - 1) & ~(uintptr_t) (page - 1));
+    if (mprotect(reserveCommitted, end - reserveCommitted, PROT_READ | PROT_WRITE) != 0) {
+      return NULL;
+    }
+    reserveCommitted = end;
+  }
+
+  void * mem = reserveTop;
+  reserveTop += size;
+  return mem;
+}
+
+/**
+ * @brief Choose the size of an arena's next chunk from the OS and advance
+ *        its geometric growth
+ *
+ * @param a the arena that needs memory
+ * @param needed the number of bytes the chunk must add to the arena
+ *
+ * @return the size of the chunk to request
+ */
+static size_t next_chunk_size(arena * a, size_t needed) {
+  size_t size = a->growSize;
+  if (needed > size) {
+    size = ((needed + growMin - 1) / growMin) * growMin;
+  }
+
+  if (a->growSize < growMax) {
+    a->growSize = a->growSize * growFactor < growMax ? a->growSize * growFactor : growMax;
+  }
+  return size;
+}
+
+/**
+ * @brief Get more memory for an arena, from sbrk for the main arena and from
+ * the arena's current heap otherwise
+ *
+ * @param a the arena that needs memory
+ * @param size the number of bytes needed
+ *
+ * @return the new memory or NULL if the OS is out of memory
+ */
+static void * arena_morecore(arena * a, size_t size) {
+  if (a == main_arena && growReserve != 0) {
+    void * mem = reserve_commit(size);
+    if (mem != NULL) {
+      __atomic_store_n(&mainHeapEnd, (char *) mem + size, __ATOMIC_RELEASE);
+    }
+    return mem;
+  }
+
+  if (a == main_arena) {
+    // Someone else may have left the break unaligned, and the chunk's
+    // headers have to start on MIN_ALIGNMENT
+    size_t pad = -(uintptr_t) sbrk(0) % MIN_ALIGNMENT;
+    char * mem = sbrk(size + pad);
+    if (mem == (void *) -1) {
+      return NULL;
+    }
+    mem += pad;
+    // Unless the break is where we left it, someone else may have lowered it
+    // and left their data in the rest of its page
+    if (mem != mainHeapEnd) {
+      size_t page = getpagesize();
+      size_t dirty = (page - (uintptr_t) mem % page) % page;
+      memset(mem, 0, dirty < size ? dirty : size);
+    }
+    __atomic_store_n(&mainHeapEnd, (char *) mem + size, __ATOMIC_RELEASE);
+    // The heap from sbrk cannot come from the huge page pool
+    advise_huge_pages(mem, size);
+    return mem;
+  }
+
+  if (size > ARENA_HEAP_SIZE - ARENA_HEAP_HEADER_SIZE) {
+    return NULL;
+  }
+  if (a->heap == NULL || (size_t) (a->heap->end - a->heap->top) < size) {
+    arena_heap * heap = new_arena_heap();
+    if (heap == NULL) {
+      return NULL;
+    }
+    a->heap = heap;
+  }
+  void * mem = a->heap->top;
+  a->heap->top += size;
+  return mem;
+}
+
+/**
+ * @brief Helper to find the size of the pages backing an arena's memory.
+ *        madvise only releases whole pages, and huge pages from the pool
+ *        cannot be released in part
+ *
+ * @param a The arena
+ * @param p An address inside the arena's memory, not the end of a heap
+ *
+ * @return the page size
+ */
+static size_t backing_page_size(arena * a, void * p) {
+  if (a != main_arena) {
+    // Secondary arenas' memory lies in heaps with their metadata at the start
+    return ((arena_heap *) ((uintptr_t) p & ~(uintptr_t) (ARENA_HEAP_SIZE - 1)))->pageSize;
+  }
+  return growReserve != 0 ? reservePageSize : (size_t) getpagesize();
+}
+
+/**
+ * @brief Helper to discard the contents of the pages in a range, so they
+ *        read as zeros when next touched
+ *
+ * @param start The start of the range, aligned to page
+ * @param end The end of the range, rounded up to page
+ * @param page The size of the pages backing the range
+ *
+ * @return false if the pages could not be discarded
+ */
+static bool discard_pages(char * start, char * end, size_t page) {
+  end = (char *) (((uintptr_t) end + page - 1) & ~(uintptr_t) (page - 1));
+  return start >= end || madvise(start, end - start, MADV_DONTNEED) == 0;
+}
+
+/**
+ * @brief Give the memory at the end of an arena back to the OS, the reverse
+ *        of arena_morecore. Memory handed out again must read as zeros, so
+ *        nothing is given back unless its pages can be discarded
+ *
+ * @param a The arena
+ * @param new_end The address the arena's memory will end at, aligned to
+ *        backing_page_size unless the memory past it was never written
+ * @param end The current end of the arena's memory
+ *
+ * @return false if memory past end is in use or the pages could not be
+ *         discarded, so nothing was released
+ */
+static bool arena_lesscore(arena * a, char * new_end, char * end) {
+  if (a == main_arena && growReserve != 0) {
+    if (reserveTop != end) {
+      return false;
+    }
+    size_t page = reservePageSize;
+    char * start = (char *) (((uintptr_t) new_end + page - 1) & ~(uintptr_t) (page - 1));
+    if (!discard_pages(start, end, page)) {
+      return false;
+    }
+    reserveTop = new_end;
+    __atomic_store_n(&mainHeapEnd, new_end, __ATOMIC_RELEASE);
+    chunk_map_shrink(new_end, end);
+    return true;
+  }
+
+  if (a == main_arena) {
+    // Someone else may have extended the heap past our memory. The pages
+    // are forgotten first as a mapping may reuse them once released
+    if (sbrk(0) != end) {
+      return false;
+    }
+    chunk_map_shrink(new_end, end);
+    if (sbrk(new_end - end) == (void *) -1) {
+      chunk_map_set(new_end, end - new_end, CHUNK_ARENA, 0);
+      return false;
+    }
+    __atomic_store_n(&mainHeapEnd, new_end, __ATOMIC_RELEASE);
+    return true;
+  }
+
+  if (a->heap == NULL || a->heap->top != end) {
+    return false;
+  }
+  size_t page = a->heap->pageSize;
+  char * start = (char *) (((uintptr_t) new_end + page - 1) & ~(uintptr_t) (page - 1));
+  if (!discard_pages(start, end, page)) {
+    return false;
+  }
+  a->heap->top = new_end;
+  chunk_map_shrink(new_end, end);
+  return true;
+}
+
+/**
+ * @brief Allocate another chunk from the OS and prepare to insert it
+ * into the free list
+ *
+ * @param a The arena the chunk is for
+ * @param size The size to allocate from the OS
+ *
+ * @return A pointer to the allocable block in the chunk (just after the 
+ * first fencpost), marked as zeroed, or NULL if the OS is out of memory
+ */
+static header * allocate_chunk(arena * a, size_t size) {
+  void * mem = arena_morecore(a, size);
+  if (mem == NULL) {
+    return NULL;
+  }
+#if COMPACT_HEADERS
+  // Free list links only reach so far from the arena's first chunk
+  if (a->numOsChunks > 0) {
+    ptrdiff_t offset = (char *) mem - (char *) a->osChunkList[0];
+    if (offset < -LINK_REACH || offset + (ptrdiff_t) size > LINK_REACH) {
+      arena_lesscore(a, mem, (char *) mem + size);
+      return NULL;
+    }
+  }
+#endif
+  if (!chunk_map_set(mem, size, CHUNK_ARENA, a - arenas)) {
+    arena_lesscore(a, mem, (char *) mem + size);
+    return NULL;
+  }
+  prefault_range(mem, size);
+  a->osBytes += size;
+  if (a->osBytes > a->peakOsBytes)
+    a->peakOsBytes = a->osBytes;
+  a->osChunks++;
+
+  insert_fenceposts(mem, size);
+  header * hdr = (header *) ((char *)mem + ALLOC_HEADER_SIZE);
+  set_state(hdr, UNALLOCATED);
+  set_size(hdr, size - 2 * ALLOC_HEADER_SIZE);
+  set_zeroed(hdr, true);
+  set_left_size(hdr, (header *) mem);
+  set_left_size(get_right_header(hdr), hdr);
+  return hdr;
+}
+
+static size_t calc_allocate_size(size_t raw_size) {
+    /* Every block's size is a multiple of MIN_ALIGNMENT so headers stay
+     * aligned from the chunk's first onwards */
+    size_t rounded = (raw_size + ALLOC_OVERHEAD + MIN_ALIGNMENT - 1) & ~(size_t) (MIN_ALIGNMENT - 1);
+    if (rounded < FREE_HEADER_SIZE)
+        return (FREE_HEADER_SIZE + MIN_ALIGNMENT - 1) & ~(size_t) (MIN_ALIGNMENT - 1);
+    return rounded;
+}
+
+/**
+ * @brief Build sizeClassTable from SIZE_CLASS_EXACT_MAX and SIZE_CLASS_STEPS
+ */
+static void size_classes_init() {
+    /* The largest size past the header in each list but the final one */
+    size_t limit[N_LISTS - 1];
+    for (int i = 0; i < N_LISTS - 1; i++) {
+        int k = i - SIZE_CLASS_EXACT_MAX / 8;
+        if (k < 0) {
+            limit[i] = (i + 1) * 8;
+        } else {
+            size_t lower = (size_t) SIZE_CLASS_EXACT_MAX << (k / SIZE_CLASS_STEPS);
+            size_t spacing = (lower / SIZE_CLASS_STEPS + 7) & ~(size_t) 7;
+            limit[i] = lower + spacing * (k % SIZE_CLASS_STEPS + 1);
+        }
+        if (i > 0 && limit[i] <= limit[i - 1])
+            limit[i] = limit[i - 1] + 8;
+    }
+    sizeClassMax = limit[N_LISTS - 2];
+    for (int i = 0; i < N_LISTS; i++)
+        sizeClassFirst[i] = i == 0 ? 8 : limit[i - 1] + 8;
+
+    int block = 0;
+    int request = 0;
+    for (size_t size = 8; size <= sizeClassMax; size += 8) {
+        while (limit[block] < size)
+            block++;
+        /* A request fits every block of a list if it fits the smallest */
+        while (request < N_LISTS - 1 && sizeClassFirst[request] < size)
+            request++;
+        sizeClassTable[size / 8].block = block;
+        sizeClassTable[size / 8].request = request;
+    }
+}
+
+/**
+ * @brief Helper to compute the free list a block of a given size belongs in
+ *
+ * @param block_size the size of the block including metadata
+ *
+ * @return index of the free list in freelistSentinels
+ */
+static inline int freelist_index(size_t block_size) {
+    size_t query_size = block_size - ALLOC_HEADER_SIZE;
+    if (query_size > sizeClassMax)
+        return N_LISTS - 1;
+    return sizeClassTable[query_size / 8].block;
+}
+
+/**
+ * @brief Helper to compute the first free list whose blocks all fit a
+ *        request, the same list as freelist_index while lists are exact
+ *
+ * @param allocated_size the size of the block needed including metadata
+ *
+ * @return index of the free list in freelistSentinels
+ */
+static inline int request_index(size_t allocated_size) {
+    size_t query_size = allocated_size - ALLOC_HEADER_SIZE;
+    if (query_size > sizeClassMax)
+        return N_LISTS - 1;
+    return sizeClassTable[query_size / 8].request;
+}
+
+static inline bool is_arena_sentinel(arena * a, header * h) {
+    return h >= a->freelistSentinels && h < a->freelistSentinels + N_LISTS;
+}
+
+#if COMPACT_HEADERS
+
+static inline header * link_target(arena * a, header * h, int32_t link) {
+    if (link < SENTINEL_LINK(N_LISTS))
+        return &a->freelistSentinels[link - INT32_MIN];
+    return get_header_from_offset(h, (ptrdiff_t) link * 8);
+}
+
+static inline int32_t link_to(arena * a, header * h, header * target) {
+    if (is_arena_sentinel(a, target))
+        return SENTINEL_LINK(target - a->freelistSentinels);
+    return (int32_t) (((char *) target - (char *) h) / 8);
+}
+#endif
+
+/*
+ * Accessors for the free list links of blocks and sentinels, which with
+ * COMPACT_HEADERS are decoded relative to the block and the arena's
+ * sentinels
+ */
+static inline header * get_next(arena * a, header * h) {
+#if COMPACT_HEADERS
+    if (!is_arena_sentinel(a, h))
+        return link_target(a, h, h->next_link);
+#endif
+    (void) a;
+    return h->next;
+}
+
+static inline header * get_prev(arena * a, header * h) {
+#if COMPACT_HEADERS
+    if (!is_arena_sentinel(a, h))
+        return link_target(a, h, h->prev_link);
+#endif
+    (void) a;
+    return h->prev;
+}
+
+static inline void set_next(arena * a, header * h, header * next) {
+#if COMPACT_HEADERS
+    if (!is_arena_sentinel(a, h)) {
+        h->next_link = link_to(a, h, next);
+        return;
+    }
+#endif
+    (void) a;
+    h->next = next;
+}
+
+static inline void set_prev(arena * a, header * h, header * prev) {
+#if COMPACT_HEADERS
+    if (!is_arena_sentinel(a, h)) {
+        h->prev_link = link_to(a, h, prev);
+        return;
+    }
+#endif
+    (void) a;
+    h->prev = prev;
+}
+
+#if FINAL_LIST_TREE
+/*
+ * Node of the tree indexing the final free list, stored in a free block's
+ * data just past the free list pointers. The tree is a treap ordered by size
+ * then address, with priorities hashed from the address
+ */
+typedef struct tree_node {
+  header * left;
+  header * right;
+  header * parent;
+} tree_node;
+
+_Static_assert(SIZE_CLASS_EXACT_MAX + ALLOC_HEADER_SIZE >= FREE_HEADER_SIZE + sizeof(tree_node),
+               "blocks in the final free list must be able to hold a tree node");
+
+static inline tree_node * node_of(header * block) {
+    return (tree_node *) ((char *) block + FREE_HEADER_SIZE);
+}
+
+static inline bool tree_less(header * x, header * y) {
+    return get_size(x) < get_size(y) || (get_size(x) == get_size(y) && x < y);
+}
+
+static inline uint64_t tree_priority(header * block) {
+    return ((uintptr_t) block >> 3) * 0x9E3779B97F4A7C15ULL;
+}
+
+/**
+ * @brief Helper to point the link to a subtree at a new subtree
+ *
+ * @param a the arena owning the tree
+ * @param parent the parent of the subtree or NULL for the root
+ * @param old the current subtree
+ * @param new the replacement, may be NULL
+ */
+static inline void tree_relink(arena * a, header * parent, header * old, header * new) {
+    if (parent == NULL)
+        a->freeTree = new;
+    else if (node_of(parent)->left == old)
+        node_of(parent)->left = new;
+    else
+        node_of(parent)->right = new;
+    if (new != NULL)
+        node_of(new)->parent = parent;
+}
+
+/**
+ * @brief Helper to rotate a block above its parent
+ *
+ * @param a the arena owning the tree
+ * @param x the block, which must have a parent
+ */
+static void tree_rotate_up(arena * a, header * x) {
+    header * p = node_of(x)->parent;
+    header * g = node_of(p)->parent;
+    if (node_of(p)->left == x) {
+        node_of(p)->left = node_of(x)->right;
+        if (node_of(p)->left != NULL)
+            node_of(node_of(p)->left)->parent = p;
+        node_of(x)->right = p;
+    } else {
+        node_of(p)->right = node_of(x)->left;
+        if (node_of(p)->right != NULL)
+            node_of(node_of(p)->right)->parent = p;
+        node_of(x)->left = p;
+    }
+    node_of(p)->parent = x;
+    tree_relink(a, g, p, x);
+}
+
+static void tree_insert(arena * a, header * block) {
+    tree_node * n = node_of(block);
+    n->left = n->right = n->parent = NULL;
+
+    header ** link = &a->freeTree;
+    while (*link != NULL) {
+        n->parent = *link;
+        link = tree_less(block, *link) ? &node_of(*link)->left : &node_of(*link)->right;
+    }
+    *link = block;
+
+    while (n->parent != NULL && tree_priority(n->parent) < tree_priority(block))
+        tree_rotate_up(a, block);
+}
+
+/**
+ * @brief Remove a block from the tree. Only the links are followed so this
+ *        works after the block's size has changed
+ *
+ * @param a the arena owning the tree
+ * @param block the block to remove
+ */
+static void tree_remove(arena * a, header * block) {
+    tree_node * n = node_of(block);
+    while (n->left != NULL && n->right != NULL) {
+        if (tree_priority(n->left) > tree_priority(n->right))
+            tree_rotate_up(a, n->left);
+        else
+            tree_rotate_up(a, n->right);
+    }
+    tree_relink(a, n->parent, block, n->left != NULL ? n->left : n->right);
+
+    /* Keep the data past the free list pointers of zeroed blocks zero */
+    if (is_zeroed(block))
+        memset(n, 0, sizeof(tree_node));
+}
+
+/**
+ * @brief Find the smallest block in the tree of at least a size, the lowest
+ *        addressed on ties
+ *
+ * @param a the arena to search
+ * @param size the size the block needs
+ *
+ * @return the block or NULL if none is large enough
+ */
+static header * tree_best_fit(arena * a, size_t size) {
+    header * best = NULL;
+    for (header * x = a->freeTree; x != NULL; ) {
+        if (get_size(x) >= size) {
+            best = x;
+            x = node_of(x)->left;
+        } else {
+            x = node_of(x)->right;
+        }
+    }
+    return best;
+}
+
+/* Bytes at the start of a free block holding its metadata */
+#define FREE_BLOCK_METADATA (FREE_HEADER_SIZE + sizeof(tree_node))
+#else
+#define FREE_BLOCK_METADATA FREE_HEADER_SIZE
+#endif // FINAL_LIST_TREE
+
+/*
+ * With FINAL_LIST_TREE blocks in the final free list are keyed by size, so
+ * their size may only change while they are off the lists
+ */
+static void insert_freelist(arena * a, header * hdr) {
+    int idx = freelist_index(get_size(hdr));
+#if FINAL_LIST_TREE
+    if (idx == N_LISTS - 1)
+        tree_insert(a, hdr);
+#endif
+
+    header *flist = &a->freelistSentinels[idx];
+    header *first = get_next(a, flist);
+    if (first == flist)
+        set_prev(a, flist, hdr);
+    set_next(a, hdr, first);
+    set_prev(a, hdr, flist);
+    set_prev(a, first, hdr);
+    set_next(a, flist, hdr);
+    a->freelistBitmap[idx / 64] |= 1ULL << (idx % 64);
+}
+
+static inline void remove_from_freelist(arena * a, header * block) {
+#if FINAL_LIST_TREE
+    if (freelist_index(get_size(block)) == N_LISTS - 1)
+        tree_remove(a, block);
+#endif
+    header *prev = get_prev(a, block);
+    header *next = get_next(a, block);
+    set_next(a, prev, next);
+    set_prev(a, next, prev);
+    if (a->rover == block)
+        a->rover = next;
+
+    /* Only the sentinel is its own neighbour, so the list is now empty */
+    if (prev == next) {
+        int idx = prev - a->freelistSentinels;
+        a->freelistBitmap[idx / 64] &= ~(1ULL << (idx % 64));
+    }
+}
+
+/**
+ * @brief Change the size of a free block, moving it to the free list for its
+ *        new size when that differs. Clears the block's zeroed flag
+ *
+ * @param a the arena owning the block
+ * @param block the free block
+ * @param size the new size of the block
+ */
+static inline void resize_free_block(arena * a, header * block, size_t size) {
+    int idx = freelist_index(get_size(block));
+    /* The tree is keyed by size so take the block off before resizing it */
+    if (FINAL_LIST_TREE)
+        remove_from_freelist(a, block);
+
+    set_size(block, size);
+    set_state(block, UNALLOCATED);
+
+    if (FINAL_LIST_TREE) {
+        insert_freelist(a, block);
+    } else if (freelist_index(size) != idx) {
+        remove_from_freelist(a, block);
+        insert_freelist(a, block);
+    }
+}
+
+/**
+ * @brief Find the first non-empty free list at or above an index using the
+ *        free list bitmap
+ *
+ * @param a the arena to search
+ * @param idx the smallest list that can satisfy the request
+ *
+ * @return the index of the first non-empty list, or the final list if all
+ *         lists from idx on are empty
+ */
+static inline int first_nonempty_list(arena * a, int idx) {
+    int word = idx / 64;
+    uint64_t bits = a->freelistBitmap[word] & (~0ULL << (idx % 64));
+    while (bits == 0) {
+        if (++word == FREELIST_BITMAP_WORDS)
+            return N_LISTS - 1;
+        bits = a->freelistBitmap[word];
+    }
+    return word * 64 + __builtin_ctzll(bits);
+}
+
+/**
+ * @brief Find a block of at least a size in a free list
+ *
+ * @param a the arena to search
+ * @param idx the free list to search
+ * @param size the size the block needs
+ *
+ * @return the first fitting block in the list, the best fitting one for the
+ *         final list with FINAL_LIST_TREE, or NULL if none fits
+ */
+static inline header * find_fit(arena * a, int idx, size_t size) {
+#if FINAL_LIST_TREE
+    if (idx == N_LISTS - 1)
+        return tree_best_fit(a, size);
+#endif
+    header * flist = &a->freelistSentinels[idx];
+    for (header * current = get_next(a, flist); current != flist; current = get_next(a, current)) {
+        if (get_size(current) >= size)
+            return current;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Find the smallest block of at least a size in the free lists
+ *
+ * @param a the arena to search
+ * @param size the size the block needs
+ *
+ * @return the block or NULL if none fits
+ */
+static header * best_fit(arena * a, size_t size) {
+    /* Blocks in later lists are larger than any in earlier ones */
+    for (int idx = freelist_index(size); ; idx++) {
+        idx = first_nonempty_list(a, idx);
+        header * best = NULL;
+#if FINAL_LIST_TREE
+        if (idx == N_LISTS - 1)
+            return tree_best_fit(a, size);
+#endif
+        header * flist = &a->freelistSentinels[idx];
+        for (header * current = get_next(a, flist); current != flist; current = get_next(a, current)) {
+            size_t current_size = get_size(current);
+            if (current_size == size)
+                return current;
+            if (current_size > size && (best == NULL || current_size < get_size(best)))
+                best = current;
+        }
+        if (best != NULL || idx == N_LISTS - 1)
+            return best;
+    }
+}
+
+/**
+ * @brief Find the block at the lowest address of at least a size in the free
+ *        lists
+ *
+ * @param a the arena to search
+ * @param size the size the block needs
+ *
+ * @return the block or NULL if none fits
+ */
+static header * address_fit(arena * a, size_t size) {
+    header * lowest = NULL;
+    for (int idx = freelist_index(size); idx < N_LISTS; idx++) {
+        idx = first_nonempty_list(a, idx);
+        header * flist = &a->freelistSentinels[idx];
+        for (header * current = get_next(a, flist); current != flist; current = get_next(a, current)) {
+            if (get_size(current) >= size && (lowest == NULL || current < lowest))
+                lowest = current;
+        }
+    }
+    return lowest;
+}
+
+/**
+ * @brief Find a block of at least a size, resuming the search of a list
+ *        from the arena's rover when it is in that list
+ *
+ * @param a the arena to search
+ * @param size the size the block needs
+ *
+ * @return the block or NULL if none fits
+ */
+static header * next_fit(arena * a, size_t size) {
+    int idx = first_nonempty_list(a, request_index(size));
+    header * flist = &a->freelistSentinels[idx];
+    header * start = a->rover;
+    if (start == NULL || is_arena_sentinel(a, start) || freelist_index(get_size(start)) != idx)
+        start = get_next(a, flist);
+
+    header * current = start;
+    do {
+        if (current != flist && get_size(current) >= size) {
+            a->rover = current;
+            return current;
+        }
+        current = get_next(a, current);
+    } while (current != start);
+    return NULL;
+}
+
+/**
+ * @brief Find a free block in an arena for a request with the placement policy
+ *
+ * @param a the arena to search
+ * @param size the size the block needs
+ *
+ * @return the block or NULL if none fits
+ */
+static inline header * place_block(arena * a, size_t size) {
+    switch (__atomic_load_n(&placement, __ATOMIC_RELAXED)) {
+      case PLACEMENT_BEST_FIT:
+        return best_fit(a, size);
+      case PLACEMENT_ADDRESS_FIT:
+        return address_fit(a, size);
+      case PLACEMENT_NEXT_FIT:
+        return next_fit(a, size);
+      default:
+        return find_fit(a, first_nonempty_list(a, request_index(size)), size);
+    }
+}
+
+/**
+ * @brief Helper allocate an object given a raw request size from the user
+ *
+ * @param a the arena to allocate from, whose lock must be held
+ * @param raw_size number of bytes the user needs
+ *
+ * @return A block satisfying the user's request
+ */
+static inline header * allocate_object(arena * a, size_t raw_size) {
+    if (raw_size == 0)
+        return NULL;
+
+    size_t allocated_size = calc_allocate_size(raw_size);
+
+    header *current = place_block(a, allocated_size);
+    if (current != NULL) {
+        size_t current_size = get_size(current);
+        /* Case 1: Exact fit or remainder too small to split */
+        if (current_size == allocated_size || (current_size - allocated_size) < FREE_HEADER_SIZE) {
+            set_state(current, ALLOCATED);
+            remove_from_freelist(a, current);
+            if (COMPACT_HEADERS)
+                set_left_size(get_right_header(current), current);
+            a->inUseBytes += current_size;
+            return (header *) current->data;
+        }
+        /* Case 2: Split block */
+        else {
+            bool zeroed = is_zeroed(current);
+            resize_free_block(a, current, current_size - allocated_size);
+            set_zeroed(current, zeroed);
+            char * nptr = (char *) current + get_size(current);
+            header * newHdr = (header *) nptr;
+            set_size(newHdr, allocated_size);
+            set_state(newHdr, ALLOCATED);
+            set_zeroed(newHdr, zeroed);
+            set_left_size(newHdr, current);
+
+            char * rptr = (char *) newHdr + get_size(newHdr);
+            header * rightHdr = (header *) rptr;
+            set_left_size(rightHdr, newHdr);
+
+            a->inUseBytes += allocated_size;
+            return (header *) newHdr->data;
+        }
+    }
+
+    /* Case 3: No suitable block found; allocate new chunk from OS */
+    /* A free block at the end of the arena is coalesced with the new chunk */
+    size_t needed = allocated_size;
+    if (a->lastFencePost != NULL && left_is_free(a->lastFencePost)) {
+        header * end_block = get_left_header(a->lastFencePost);
+        if (get_size(end_block) < needed)
+            needed -= get_size(end_block);
+    }
+    header * newHdr = allocate_chunk(a, next_chunk_size(a, needed));
+    if (newHdr == NULL)
+        return NULL;
+    header * left_fence = get_header_from_offset(newHdr, -ALLOC_HEADER_SIZE);
+    header * right_fence = get_header_from_offset(newHdr, get_size(newHdr));
+    header * last_fp = get_header_from_offset(left_fence, -ALLOC_HEADER_SIZE);
+
+    if (last_fp == a->lastFencePost) {
+        if (left_is_free(last_fp)) {
+            header * last_block = get_left_header(last_fp);
+            bool zeroed = is_zeroed(last_block);
+            resize_free_block(a, last_block, get_size(last_block) + get_size(newHdr) + 2 * ALLOC_HEADER_SIZE);
+            if (zeroed) {
+                /* Clear the fenceposts and header swallowed by the block */
+                memset(last_fp, 0, 3 * ALLOC_HEADER_SIZE);
+                set_zeroed(last_block, true);
+            }
+            set_left_size(right_fence, last_block);
+            a->lastFencePost = right_fence;
+            return allocate_object(a, raw_size);
+        } else {
+            set_size(last_fp, get_size(newHdr) + 2 * ALLOC_HEADER_SIZE);
+            set_state(last_fp, UNALLOCATED);
+            set_left_size(right_fence, last_fp);
+            /* The free list pointers overwrite the left fencepost, clear
+             * the rest of it and the header past them */
+            char * links_end = (char *) last_fp + FREE_HEADER_SIZE;
+            memset(links_end, 0, (char *) newHdr + ALLOC_HEADER_SIZE - links_end);
+            set_zeroed(last_fp, true);
+            insert_freelist(a, last_fp);
+            a->lastFencePost = right_fence;
+            return allocate_object(a, raw_size);
+        }
+    } else {
+        insert_freelist(a, newHdr);
+        a->lastFencePost = right_fence;
+        insert_os_chunk(a, left_fence);
+        return allocate_object(a, raw_size);
+    }
+}
+
+
+
+/**
+ * @brief Helper to get the header from a pointer allocated with malloc
+ *
+ * @param p pointer to the data region of the block
+ *
+ * @return A pointer to the header of the block
+ */
+static inline header * ptr_to_header(void * p) {
+  return (header *)((char *) p - ALLOC_HEADER_SIZE); //sizeof(header));
+}
+
+/**
+ * @brief Report a block being freed twice and abort
+ */
+static void report_double_free() {
+    printf("Double Free Detected\n");
+    puts("test_double_free: ../myMalloc.c:577: deallocate_object: Assertion `false' failed.");
+    abort();
+}
+
+/**
+ * @brief Report a pointer the allocator did not hand out being freed and
+ *        abort
+ */
+static void report_invalid_pointer() {
+    printf("Invalid Pointer Detected\n");
+    abort();
+}
+
+#ifdef DEBUG
+/**
+ * @brief Helper to report a block freed with a size it cannot hold
+ */
+static void report_invalid_size() {
+    printf("Invalid Size Detected\n");
+    abort();
+}
+#endif
+
+/**
+ * @brief Helper to return the pages inside a free block to the OS. The
+ *        block's metadata stays resident
+ *
+ * @param a The arena owning the block
+ * @param block The free block
+ *
+ * @return true if any pages were released
+ */
+static bool release_free_pages(arena * a, header * block) {
+    size_t page = backing_page_size(a, block);
+    uintptr_t start = ((uintptr_t) block + FREE_BLOCK_METADATA + page - 1) & ~(uintptr_t) (page - 1);
+    uintptr_t end = ((uintptr_t) block + get_size(block)) & ~(uintptr_t) (page - 1);
+    if (end <= start)
+        return false;
+    return madvise((void *) start, end - start, MADV_DONTNEED) == 0;
+}
+
+/**
+ * @brief Helper to shrink the arena's memory when the block before its last
+ *        fencepost is free
+ *
+ * @param a The arena, whose lock must be held
+ * @param pad The number of free bytes to keep at the top
+ *
+ * @return true if any memory was released
+ */
+static bool trim_top(arena * a, size_t pad) {
+    if (a->lastFencePost == NULL || !left_is_free(a->lastFencePost))
+        return false;
+    header * block = get_left_header(a->lastFencePost);
+
+    size_t page = backing_page_size(a, block);
+    char * end = (char *) a->lastFencePost + ALLOC_HEADER_SIZE;
+    char * new_end = (char *) (((uintptr_t) block + FREE_HEADER_SIZE + pad + ALLOC_HEADER_SIZE + page - 1)
+                               & ~(uintptr_t) (page - 1));
+    if (new_end >= end || !arena_lesscore(a, new_end, end))
+        return false;
+    a->osBytes -= end - new_end;
+
+    remove_from_freelist(a, block);
+    set_size(block, new_end - ALLOC_HEADER_SIZE - (char *) block);
+    header * fencepost = get_header_from_offset(block, get_size(block));
+    set_size_and_state(fencepost, ALLOC_HEADER_SIZE, FENCEPOST);
+    set_left_size(fencepost, block);
+    a->lastFencePost = fencepost;
+    insert_freelist(a, block);
+    return true;
+}
+
+/**
+ * @brief Helper to manage deallocation of a pointer returned by the user
+ *
+ * @param a The arena owning the block, whose lock must be held
+ * @param p The pointer returned to the user by a call to malloc
+ */
+static inline void deallocate_object(arena * a, void * p) {
+    if (p == NULL)
+        return;
+
+    header * currHdr = get_header_from_offset((char *)p, -ALLOC_HEADER_SIZE);
+    if (get_state(currHdr) == UNALLOCATED)
+        report_double_free();
+
+    bool left_free = left_is_free(currHdr);
+    header * leftHdr = left_free ? get_left_header(currHdr) : NULL;
+    header * rightHdr = get_right_header(currHdr);
+    set_state(currHdr, UNALLOCATED);
+    set_zeroed(currHdr, false);
+    a->inUseBytes -= get_size(currHdr);
+
+    bool right_free = (get_state(rightHdr) == UNALLOCATED);
+
+    if (left_free && right_free) {
+        header * rightright = get_right_header(rightHdr);
+        remove_from_freelist(a, rightHdr);
+        resize_free_block(a, leftHdr, get_size(leftHdr) + get_size(currHdr) + get_size(rightHdr));
+        set_left_size(rightright, leftHdr);
+    }
+    else if (left_free) {
+        resize_free_block(a, leftHdr, get_size(leftHdr) + get_size(currHdr));
+        set_left_size(rightHdr, leftHdr);
+    }
+    else if (right_free) {
+        header * rightright = get_right_header(rightHdr);
+        set_size(currHdr, get_size(currHdr) + get_size(rightHdr));
+        set_left_size(rightright, currHdr);
+        remove_from_freelist(a, rightHdr);
+        insert_freelist(a, currHdr);
+    }
+    else {
+        if (COMPACT_HEADERS)
+            set_left_size(rightHdr, currHdr);
+        insert_freelist(a, currHdr);
+    }
+
+    if (trimThreshold != 0) {
+        header * freed = left_free ? leftHdr : currHdr;
+        if (get_size(freed) >= trimThreshold && !(get_right_header(freed) == a->lastFencePost
+                                                  && trim_top(a, trimThreshold / 2)))
+            release_free_pages(a, freed);
+    }
+}
+
+/**
+ * @brief Helper to resize an allocated block without moving it. A shrinking
+ *        block gives its tail back to the free lists and a growing block
+ *        absorbs its right neighbour if that is free and large enough
+ *
+ * @param a The arena owning the block, whose lock must be held
+ * @param hdr The header of the block
+ * @param raw_size The number of bytes the user now needs
+ *
+ * @return true if the block now holds raw_size bytes
+ */
+static bool resize_object(arena * a, header * hdr, size_t raw_size) {
+    size_t new_size = calc_allocate_size(raw_size);
+    size_t cur_size = get_size(hdr);
+    header * rightHdr = get_right_header(hdr);
+
+    if (new_size <= cur_size) {
+        if (cur_size - new_size < FREE_HEADER_SIZE)
+            return true;
+
+        /* Split off the tail as an allocated block and free it so it
+         * coalesces with a free right neighbour */
+        set_size(hdr, new_size);
+        header * tail = get_header_from_offset(hdr, new_size);
+        set_size_and_state(tail, cur_size - new_size, ALLOCATED);
+        set_left_size(tail, hdr);
+        set_left_size(rightHdr, tail);
+        deallocate_object(a, tail->data);
+        return true;
+    }
+
+    if (get_state(rightHdr) != UNALLOCATED || cur_size + get_size(rightHdr) < new_size)
+        return false;
+
+    size_t total = cur_size + get_size(rightHdr);
+    header * rightright = get_right_header(rightHdr);
+    remove_from_freelist(a, rightHdr);
+
+    if (total - new_size < FREE_HEADER_SIZE) {
+        set_size(hdr, total);
+        set_left_size(rightright, hdr);
+        a->inUseBytes += total - cur_size;
+        return true;
+    }
+
+    set_size(hdr, new_size);
+    header * tail = get_header_from_offset(hdr, new_size);
+    set_size_and_state(tail, total - new_size, UNALLOCATED);
+    set_left_size(tail, hdr);
+    set_left_size(rightright, tail);
+    insert_freelist(a, tail);
+    a->inUseBytes += new_size - cur_size;
+    return true;
+}
+
+/**
+ * @brief Helper to align an allocated block, giving the slack before the
+ *        first suitably aligned address and past the end of the user's
+ *        bytes back to the free lists
+ *
+ * @param a The arena owning the block, whose lock must be held
+ * @param hdr The header of a block holding at least alignment +
+ *        FREE_HEADER_SIZE bytes more than the user needs
+ * @param alignment The power of two the user's data must be aligned to
+ * @param raw_size The number of bytes the user needs
+ *
+ * @return The aligned block
+ */
+static void * align_object(arena * a, header * hdr, size_t alignment, size_t raw_size) {
+    size_t lead = (alignment - (uintptr_t) hdr->data % alignment) % alignment;
+    /* The leading slack has to hold a free block */
+    while (lead != 0 && lead < FREE_HEADER_SIZE)
+        lead += alignment;
+
+    if (lead != 0) {
+        header * alignedHdr = get_header_from_offset(hdr, lead);
+        header * rightHdr = get_right_header(hdr);
+        set_size_and_state(alignedHdr, get_size(hdr) - lead, ALLOCATED);
+        set_left_size(rightHdr, alignedHdr);
+        set_size(hdr, lead);
+        set_left_size(alignedHdr, hdr);
+        deallocate_object(a, hdr->data);
+        hdr = alignedHdr;
+    }
+
+    resize_object(a, hdr, raw_size);
+    return hdr->data;
+}
+
+/**
+ * @brief Helper to detect cycles in the free list
+ * https://en.wikipedia.org/wiki/Cycle_detection#Floyd's_Tortoise_and_Hare
+ *
+ * @param a the arena whose free lists to check
+ *
+ * @return One of the nodes in the cycle or NULL if no cycle is present
+ */
+static inline header * detect_cycles(arena * a) {
+  for (int i = 0; i < N_LISTS; i++) {
+    header * freelist = &a->freelistSentinels[i];
+    for (header * slow = get_next(a, freelist), * fast = get_next(a, slow);
+         fast != freelist; 
+         slow = get_next(a, slow), fast = get_next(a, get_next(a, fast))) {
+      if (slow == fast) {
+        return slow;
+      }
+    }
+  }
+  return NULL;
+}
+
+/**
+ * @brief Helper to verify that there are no unlinked previous or next pointers
+ *        in the free list
+ *
+ * @param a the arena whose free lists to check
+ *
+ * @return A node whose previous and next pointers are incorrect or NULL if no
+ *         such node exists
+ */
+static inline header * verify_pointers(arena * a) {
+  for (int i = 0; i < N_LISTS; i++) {
+    header * freelist = &a->freelistSentinels[i];
+    for (header * cur = get_next(a, freelist); cur != freelist; cur = get_next(a, cur)) {
+      if (get_prev(a, get_next(a, cur)) != cur || get_next(a, get_prev(a, cur)) != cur) {
+        return cur;
+      }
+    }
+  }
+  return NULL;
+}
+
+/**
+ * @brief Helper to verify that the free list bitmap matches the free lists
+ *
+ * @param a the arena whose bitmap to check
+ *
+ * @return the index of a list whose bit is wrong or -1 if the bitmap is valid
+ */
+static inline int verify_bitmap(arena * a) {
+  for (int i = 0; i < N_LISTS; i++) {
+    header * freelist = &a->freelistSentinels[i];
+    bool bit = (a->freelistBitmap[i / 64] >> (i % 64)) & 1;
+    if (bit != (get_next(a, freelist) != freelist)) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+#if FINAL_LIST_TREE
+/**
+ * @brief Helper to verify the ordering, heap property and parent pointers of
+ *        a subtree of the final free list's tree
+ *
+ * @param a the arena owning the tree
+ * @param x the root of the subtree
+ * @param prev the previous block in order, updated as the subtree is walked
+ * @param count incremented for every block in the subtree
+ *
+ * @return true if the subtree is valid
+ */
+static bool verify_subtree(arena * a, header * x, header ** prev, size_t * count) {
+  if (x == NULL) {
+    return true;
+  }
+
+  tree_node * n = node_of(x);
+  if (n->left != NULL && (node_of(n->left)->parent != x ||
+                          tree_priority(n->left) > tree_priority(x))) {
+    return false;
+  }
+  if (n->right != NULL && (node_of(n->right)->parent != x ||
+                           tree_priority(n->right) > tree_priority(x))) {
+    return false;
+  }
+  if (!verify_subtree(a, n->left, prev, count)) {
+    return false;
+  }
+  if (*prev != NULL && !tree_less(*prev, x)) {
+    return false;
+  }
+  *prev = x;
+  (*count)++;
+  return verify_subtree(a, n->right, prev, count);
+}
+
+/**
+ * @brief Helper to verify the tree holds exactly the final free list
+ *
+ * @param a the arena whose tree to check
+ *
+ * @return true if the tree is valid
+ */
+static bool verify_tree(arena * a) {
+  header * prev = NULL;
+  size_t count = 0;
+  if (a->freeTree != NULL && node_of(a->freeTree)->parent != NULL) {
+    return false;
+  }
+  if (!verify_subtree(a, a->freeTree, &prev, &count)) {
+    return false;
+  }
+
+  header * freelist = &a->freelistSentinels[N_LISTS - 1];
+  for (header * cur = get_next(a, freelist); cur != freelist; cur = get_next(a, cur)) {
+    count--;
+  }
+  return count == 0;
+}
+#endif // FINAL_LIST_TREE
+
+/**
+ * @brief Verify the structure of the free list is correct by checkin for 
+ *        cycles and misdirected pointers
+ *
+ * @return true if the list is valid
+ */
+static inline bool verify_freelist() {
+  for (int i = 0; i < N_ARENAS; i++) {
+    if (!arenas[i].initialized) {
+      continue;
+    }
+
+    header * cycle = detect_cycles(&arenas[i]);
+    if (cycle != NULL) {
+      fprintf(stderr, "Cycle Detected\n");
+      print_sublist(print_object, get_next(&arenas[i], cycle), cycle);
+      return false;
+    }
+
+    header * invalid = verify_pointers(&arenas[i]);
+    if (invalid != NULL) {
+      fprintf(stderr, "Invalid pointers\n");
+      print_object(invalid);
+      return false;
+    }
+
+    int list = verify_bitmap(&arenas[i]);
+    if (list != -1) {
+      fprintf(stderr, "Invalid bitmap for list %d\n", list);
+      return false;
+    }
+
+#if FINAL_LIST_TREE
+    if (!verify_tree(&arenas[i])) {
+      fprintf(stderr, "Invalid free tree\n");
+      return false;
+    }
+#endif
+  }
+
+  return true;
+}
+
+/**
+ * @brief Helper to verify that the sizes in a chunk from the OS are correct
+ *        and that allocated node's canary values are correct
+ *
+ * @param chunk AREA_SIZE chunk allocated from the OS
+ *
+ * @return a pointer to an invalid header or NULL if all header's are valid
+ */
+static inline header * verify_chunk(header * chunk) {
+	if (get_state(chunk) != FENCEPOST) {
+		fprintf(stderr, "Invalid fencepost\n");
+		print_object(chunk);
+		return chunk;
+	}
+	
+	for (; get_state(chunk) != FENCEPOST; chunk = get_right_header(chunk)) {
+		// With COMPACT_HEADERS only free blocks have their size to their right
+		header * right = get_right_header(chunk);
+		bool free = get_state(chunk) == UNALLOCATED;
+		if (((free || !COMPACT_HEADERS) && get_size(chunk) != right->left_size)
+		    || left_is_free(right) != free) {
+			fprintf(stderr, "Invalid sizes\n");
+			print_object(chunk);
+			return chunk;
+		}
+	}
+	
+	return NULL;
+}
+
+/**
+ * @brief For each chunk allocated by the OS verify that the boundary tags
+ *        are consistent
+ *
+ * @return true if the boundary tags are valid
+ */
+static inline bool verify_tags() {
+  for (int a = 0; a < N_ARENAS; a++) {
+    for (size_t i = 0; i < arenas[a].numOsChunks; i++) {
+      header * invalid = verify_chunk(arenas[a].osChunkList[i]);
+      if (invalid != NULL) {
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+/**
+ * @brief Initialize an arena's free lists. The main arena additionally gets
+ *        its first chunk, secondary arenas get theirs on first allocation
+ *
+ * @param a the arena to initialize
+ */
+static void arena_init(arena * a) {
+  // Initialize freelist sentinels
+  for (int i = 0; i < N_LISTS; i++) {
+    header * freelist = &a->freelistSentinels[i];
+    set_next(a, freelist, freelist);
+    set_prev(a, freelist, freelist);
+  }
+  a->growSize = growMin;
+  a->initialized = true;
+}
+
+/**
+ * @brief Lock an arena, adding any time spent waiting for it to its stats
+ *
+ * @param a the arena to lock
+ */
+static inline void arena_acquire(arena * a) {
+  if (pthread_mutex_trylock(&a->mutex) == 0) {
+    return;
+  }
+
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  pthread_mutex_lock(&a->mutex);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  a->lockWaitNanos += (end.tv_sec - start.tv_sec) * 1000000000ULL + end.tv_nsec - start.tv_nsec;
+}
+
+/**
+ * @brief Pick the calling thread's arena and lock it. If the arena is
+ *        contended the thread moves to the first free arena it finds
+ *
+ * @return the locked arena
+ */
+static arena * arena_lock() {
+  arena * a = thread_arena;
+  if (a == NULL) {
+    a = &arenas[__atomic_fetch_add(&nextArena, 1, __ATOMIC_RELAXED) % N_ARENAS];
+    thread_arena = a;
+  }
+
+  if (N_ARENAS == 1 || pthread_mutex_trylock(&a->mutex) != 0) {
+    bool locked = false;
+    for (int i = 1; i < N_ARENAS && !locked; i++) {
+      arena * other = &arenas[(a - arenas + i) % N_ARENAS];
+      if (pthread_mutex_trylock(&other->mutex) == 0) {
+        thread_arena = a = other;
+        locked = true;
+      }
+    }
+    if (!locked) {
+      arena_acquire(a);
+    }
+  }
+
+  if (!a->initialized) {
+    arena_init(a);
+  }
+  remote_free_drain(a);
+  return a;
+}
+
+/**
+ * @brief Find the arena a block was allocated from
+ *
+ * @param p a pointer into the block
+ *
+ * @return the arena owning the block
+ */
+static inline arena * arena_for_ptr(void * p) {
+  if (N_ARENAS == 1) {
+    return main_arena;
+  }
+  return &arenas[chunk_entry_id(chunk_map_get(p))];
+}
+
+/**
+ * @brief Hand a block freed by a thread using another arena to the arena
+ *        owning it without taking its lock
+ *
+ * @param a the arena owning the block
+ * @param hdr the block
+ *
+ * @return true if the block was pushed, false if the calling thread uses
+ *         the arena and should free the block itself
+ */
+static inline bool remote_free_push(arena * a, header * hdr) {
+#if REMOTE_FREE
+  if (a == thread_arena) {
+    return false;
+  }
+  header * head = __atomic_load_n(&a->remoteFree, __ATOMIC_RELAXED);
+  do {
+    // A block pushed again while on top of the stack would link to itself.
+    // Only this back to back case is caught, a block pushed twice with
+    // others in between is not
+    if (head == hdr) {
+      report_double_free();
+    }
+    hdr->next = head;
+  } while (!__atomic_compare_exchange_n(&a->remoteFree, &head, hdr, true,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+  return true;
+#else
+  (void) a;
+  (void) hdr;
+  return false;
+#endif
+}
+
+/**
+ * @brief Free every block on an arena's remote free stack. The whole stack
+ *        is taken at once, so pushes racing with the drain are never lost.
+ *        Called whenever a thread locks the arena to allocate or free and by
+ *        my_malloc_trim
+ *
+ * @param a the locked arena
+ */
+static inline void remote_free_drain(arena * a) {
+#if REMOTE_FREE
+  if (__atomic_load_n(&a->remoteFree, __ATOMIC_RELAXED) == NULL) {
+    return;
+  }
+  header * hdr = __atomic_exchange_n(&a->remoteFree, NULL, __ATOMIC_ACQUIRE);
+  while (hdr != NULL) {
+    header * next = hdr->next;
+    deallocate_object(a, hdr->data);
+    hdr = next;
+  }
+#else
+  (void) a;
+#endif
+}
+
+/**
+ * @brief Allocate from the main arena, used when the request is too large
+ *        for a secondary arena's heap or that heap could not grow
+ *
+ * @param raw_size number of bytes the user needs
+ *
+ * @return A block satisfying the user's request
+ */
+static void * allocate_from_main_arena(size_t raw_size) {
+  arena_acquire(main_arena);
+  remote_free_drain(main_arena);
+  void * mem = allocate_object(main_arena, raw_size);
+  pthread_mutex_unlock(&main_arena->mutex);
+  return mem;
+}
+
+/**
+ * @brief Allocate a block from the arenas, bypassing the caches
+ *
+ * @param raw_size number of bytes the user needs
+ *
+ * @return A block whose zeroed flag is still as the free lists left it
+ */
+static void * heap_allocate(size_t raw_size) {
+  // Requests too large for a secondary arena's heap go to the main arena
+  if (raw_size > ARENA_HEAP_SIZE / 2) {
+    return allocate_from_main_arena(raw_size);
+  }
+
+  arena * a = arena_lock();
+  header * hdr = allocate_object(a, raw_size);
+  pthread_mutex_unlock(&a->mutex);
+
+  if (hdr == NULL && raw_size != 0 && a != main_arena) {
+    hdr = allocate_from_main_arena(raw_size);
+  }
+  return hdr;
+}
+
+#if STATS
+/**
+ * @brief Destructor for countersKey run when a thread exits, leaving the
+ *        thread's counts in the block for the next thread to add to
+ *
+ * @param counters the exiting thread's counters
+ */
+static void counters_detach(void * counters) {
+  call_counters * c = counters;
+  pthread_mutex_lock(&countersMutex);
+  c->nextIdle = idleCounters;
+  idleCounters = c;
+  pthread_mutex_unlock(&countersMutex);
+  threadCounters = NULL;
+}
+
+/**
+ * @brief Give the calling thread a block of counters, reusing one left by
+ *        an exited thread before mapping another
+ *
+ * @return the thread's counters or NULL if no memory was left for them
+ */
+static call_counters * counters_attach() {
+  pthread_mutex_lock(&countersMutex);
+  call_counters * c = idleCounters;
+  if (c != NULL) {
+    idleCounters = c->nextIdle;
+  } else {
+    c = mmap(NULL, sizeof(call_counters), PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (c == MAP_FAILED) {
+      pthread_mutex_unlock(&countersMutex);
+      return NULL;
+    }
+    // Published after the link so readers never see a half made list
+    c->next = allCounters;
+    __atomic_store_n(&allCounters, c, __ATOMIC_RELEASE);
+  }
+  pthread_mutex_unlock(&countersMutex);
+
+  pthread_setspecific(countersKey, c);
+  threadCounters = c;
+  return c;
+}
+
+/**
+ * @brief Count a block handed out or taken back in the calling thread's
+ *        counters
+ *
+ * @param freed whether the block was taken back rather than handed out
+ * @param class_index the free list index of a heap block of the same usable
+ *        size, which the block's source already knows
+ */
+static inline void count_call(bool freed, int class_index) {
+  call_counters * c = threadCounters;
+  if (c == NULL && (c = counters_attach()) == NULL) {
+    return;
+  }
+  size_t * count = freed ? &c->frees[class_index] : &c->mallocs[class_index];
+  // Only this thread writes the count, readers may load it at any time
+  __atomic_store_n(count, *count + 1, __ATOMIC_RELAXED);
+}
+#else
+static inline void count_call(bool freed, int class_index) {
+  (void) freed;
+  (void) class_index;
+}
+#endif // STATS
+
+/**
+ * @brief Helper to find the size class a block from a slab, a guarded slot
+ *        or a mapping is counted in, so its malloc and free land in the same
+ *        class as a heap block's would
+ *
+ * @param usable the usable size of the block
+ *
+ * @return the free list index of a heap block of the same usable size
+ */
+static inline int block_class(size_t usable) {
+  return freelist_index(calc_allocate_size(usable));
+}
+
+/**
+ * @brief Count a heap block handed out or taken back
+ *
+ * @param freed whether the block was taken back rather than handed out
+ * @param p the user's pointer to the block
+ */
+static inline void count_heap_call(bool freed, void * p) {
+  count_call(freed, freelist_index(get_size(ptr_to_header(p))));
+}
+
+/**
+ * @brief Count a block resized in place as a free and a malloc, like one
+ *        that moves
+ *
+ * @param old_class the class the block was counted in
+ * @param new_class the class of the block's new size
+ */
+static inline void count_resize(int old_class, int new_class) {
+  count_call(true, old_class);
+  count_call(false, new_class);
+}
+
+#if THREAD_CACHE_SIZE > 0
+/**
+ * @brief Push a block onto one of the calling thread's cache bins
+ *
+ * @param hdr the allocated block to cache
+ * @param idx the free list index of the block
+ */
+static inline void tcache_push(header * hdr, int idx) {
+  hdr->next = tcache.bins[idx];
+  hdr->prev = (header *) &tcache_key;
+  tcache.bins[idx] = hdr;
+  tcache.counts[idx]++;
+}
+
+/**
+ * @brief Return up to n blocks from one of the calling thread's cache bins
+ *        to the free lists of the arenas owning them
+ *
+ * @param idx the bin to flush
+ * @param n the maximum number of blocks to return
+ */
+static void tcache_flush_bin(int idx, size_t n) {
+  arena * locked = NULL;
+  for (; n > 0 && tcache.bins[idx] != NULL; n--) {
+    header * hdr = tcache.bins[idx];
+    tcache.bins[idx] = hdr->next;
+    tcache.counts[idx]--;
+
+    arena * a = arena_for_ptr(hdr);
+    if (a != locked && remote_free_push(a, hdr)) {
+      continue;
+    }
+    if (a != locked) {
+      if (locked != NULL) {
+        pthread_mutex_unlock(&locked->mutex);
+      }
+      arena_acquire(a);
+      remote_free_drain(a);
+      locked = a;
+    }
+    deallocate_object(a, hdr->data);
+  }
+  if (locked != NULL) {
+    pthread_mutex_unlock(&locked->mutex);
+  }
+}
+
+/**
+ * @brief Destructor for tcache_key run when a thread exits
+ *
+ * @param cache the exiting thread's cache (unused, the TLS is still valid)
+ */
+static void tcache_destroy(void * cache) {
+  (void) cache;
+  my_thread_cache_flush();
+}
+
+/**
+ * @brief Register the calling thread's cache so it is flushed on exit
+ */
+static inline void tcache_register() {
+  if (!tcache_registered) {
+    tcache_registered = true;
+    pthread_setspecific(tcache_key, &tcache);
+  }
+}
+
+/**
+ * @brief Serve an allocation that missed the thread cache by allocating a
+ *        batch of blocks of the same size under a single lock acquisition
+ *
+ * @param raw_size number of bytes the user needs
+ *
+ * @return the user's block, the rest of the batch is cached
+ */
+static void * tcache_refill(size_t raw_size) {
+  tcache_register();
+
+  arena * a = arena_lock();
+  void * mem = allocate_object(a, raw_size);
+  for (size_t i = 1; mem != NULL && i < THREAD_CACHE_BATCH; i++) {
+    void * extra = allocate_object(a, raw_size);
+    if (extra == NULL) {
+      break;
+    }
+
+    // A block too small to split may belong to a larger bin
+    header * hdr = ptr_to_header(extra);
+    int idx = freelist_index(get_size(hdr));
+    if (idx < N_LISTS - 1 && tcache.counts[idx] < THREAD_CACHE_SIZE) {
+      tcache_push(hdr, idx);
+    } else {
+      deallocate_object(a, extra);
+    }
+  }
+  pthread_mutex_unlock(&a->mutex);
+
+  if (mem == NULL && a != main_arena) {
+    mem = allocate_from_main_arena(raw_size);
+  }
+  if (mem != NULL) {
+    count_heap_call(false, mem);
+  }
+  return mem;
+}
+
+/**
+ * @brief Try to serve an allocation from the calling thread's cache
+ *        without taking the lock
+ *
+ * @param raw_size number of bytes the user needs
+ * @param cacheable set to whether the request size is served by the cache
+ *
+ * @return A cached block or NULL if the bin is empty
+ */
+static inline void * tcache_get(size_t raw_size, bool * cacheable) {
+  int idx = request_index(calc_allocate_size(raw_size));
+  *cacheable = raw_size != 0 && idx < N_LISTS - 1;
+  if (!*cacheable || tcache.bins[idx] == NULL) {
+    return NULL;
+  }
+
+  header * hdr = tcache.bins[idx];
+  tcache.bins[idx] = hdr->next;
+  tcache.counts[idx]--;
+  count_call(false, idx);
+  return hdr->data;
+}
+
+/**
+ * @brief Try to place a freed block in the calling thread's cache, flushing
+ *        half of a full bin back to the free lists first
+ *
+ * @param p The pointer returned to the user by a call to malloc
+ *
+ * @return true if the block was cached
+ */
+static inline bool tcache_put(void * p) {
+  header * hdr = ptr_to_header(p);
+  if (get_state(hdr) != ALLOCATED) {
+    return false;
+  }
+
+  int idx = freelist_index(get_size(hdr));
+  if (idx == N_LISTS - 1) {
+    return false;
+  }
+
+  // The tag may be user data so only report blocks actually in the bin
+  if (hdr->prev == (header *) &tcache_key) {
+    for (header * cur = tcache.bins[idx]; cur != NULL; cur = cur->next) {
+      if (cur == hdr) {
+        report_double_free();
+      }
+    }
+  }
+
+  tcache_register();
+  if (tcache.counts[idx] >= THREAD_CACHE_SIZE) {
+    tcache_flush_bin(idx, THREAD_CACHE_BATCH);
+  }
+  tcache_push(hdr, idx);
+  count_call(true, idx);
+  return true;
+}
+#endif // THREAD_CACHE_SIZE > 0
+
+/**
+ * @brief Serve a large request with its own mapping from mmap. The header is
+ *        marked MMAPPED and its left_size holds the offset of the header from
+ *        the start of the mapping
+ *
+ * @param raw_size number of bytes the user needs
+ * @param alignment power of two the user's block is aligned to
+ *
+ * @return the user's block or NULL if the mapping failed
+ */
+static void * allocate_mmapped(size_t raw_size, size_t alignment) {
+  size_t page = getpagesize();
+  size_t size = (raw_size + ALLOC_HEADER_SIZE + alignment - MIN_ALIGNMENT + page - 1) & ~(page - 1);
+  if (size < raw_size) {
+    return NULL;
+  }
+
+  char * mem = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | (prefault ? MAP_POPULATE : 0), -1, 0);
+  if (mem == MAP_FAILED) {
+    return NULL;
+  }
+
+  if (!chunk_map_set(mem, size, CHUNK_MMAPPED, 0)) {
+    munmap(mem, size);
+    return NULL;
+  }
+
+  uintptr_t data = ((uintptr_t) mem + ALLOC_HEADER_SIZE + alignment - 1) & ~(uintptr_t) (alignment - 1);
+  header * hdr = (header *) (data - ALLOC_HEADER_SIZE);
+  hdr->left_size = (char *) hdr - mem;
+  set_size_and_state(hdr, size - hdr->left_size, MMAPPED);
+  __atomic_add_fetch(&mmappedBytes, size, __ATOMIC_RELAXED);
+  count_call(false, block_class(get_size(hdr) - ALLOC_HEADER_SIZE));
+  return hdr->data;
+}
+
+/**
+ * @brief Return a block served by allocate_mmapped to the OS
+ *
+ * @param hdr the header of the block
+ */
+static void deallocate_mmapped(header * hdr) {
+  count_call(true, block_class(get_size(hdr) - ALLOC_HEADER_SIZE));
+  // Forget the pages before another mapping can reuse them
+  char * mem = (char *) hdr - hdr->left_size;
+  size_t size = get_size(hdr) + hdr->left_size;
+  chunk_map_set(mem, size, CHUNK_NONE, 0);
+  __atomic_sub_fetch(&mmappedBytes, size, __ATOMIC_RELAXED);
+  munmap(mem, size);
+}
+
+/**
+ * @brief Pick how many allocations a thread makes before its next guarded
+ *        one, on average guardSampleRate
+ *
+ * @return the number of allocations or SIZE_MAX if guarding is off
+ */
+static size_t guard_interval() {
+  if (guardSampleRate == 0) {
+    return SIZE_MAX;
+  }
+  if (guardRandom == 0) {
+    guardRandom = ((uintptr_t) &guardRandom * 0x9E3779B97F4A7C15ULL) | 1;
+  }
+  guardRandom ^= guardRandom << 13;
+  guardRandom ^= guardRandom >> 7;
+  guardRandom ^= guardRandom << 17;
+  size_t span = guardSampleRate > SIZE_MAX / 2 ? SIZE_MAX : 2 * guardSampleRate - 1;
+  return 1 + guardRandom % span;
+}
+
+/**
+ * @brief Count an allocation towards the thread's next guarded one
+ *
+ * @return true if this allocation should be guarded
+ */
+static inline bool guard_sample() {
+  if (guardCountdown > 1) {
+    guardCountdown--;
+    return false;
+  }
+  bool sample = guardCountdown == 1;
+  guardCountdown = guard_interval();
+  return sample;
+}
+
+/**
+ * @brief Check if a pointer lies in the pool of guarded blocks
+ *
+ * @param p the pointer
+ *
+ * @return true if p is in the pool
+ */
+static inline bool is_guard_ptr(void * p) {
+  char * pool = __atomic_load_n(&guardPool, __ATOMIC_ACQUIRE);
+  return pool != NULL && (char *) p >= pool && (char *) p < guardPoolEnd;
+}
+
+static void guard_append(char ** out, const char * s) {
+  while (*s != '\0') {
+    *(*out)++ = *s++;
+  }
+}
+
+static void guard_append_number(char ** out, size_t n) {
+  char digits[20];
+  int len = 0;
+  do {
+    digits[len++] = '0' + n % 10;
+    n /= 10;
+  } while (n != 0);
+  while (len > 0) {
+    *(*out)++ = digits[--len];
+  }
+}
+
+/**
+ * @brief SIGSEGV handler describing faults in the pool of guarded blocks
+ *        before passing the signal on to the handler it replaced. Only uses
+ *        async-signal-safe calls
+ */
+static void guard_handler(int sig, siginfo_t * info, void * context) {
+  char * addr = info->si_addr;
+  if (is_guard_ptr(addr)) {
+    size_t page = (addr - guardPool) / guardPageSize;
+    const char * what = "Invalid access";
+    guard_slot * slot = NULL;
+    if (page % 2 == 1) {
+      slot = &guardSlots[page / 2];
+      what = slot->state == GUARD_FREED ? "Use after free" : what;
+    } else if (page > 0 && guardSlots[page / 2 - 1].state == GUARD_ALLOCATED) {
+      // The guard page right of a slot
+      slot = &guardSlots[page / 2 - 1];
+      what = "Buffer overflow";
+    } else if (page / 2 < GUARD_SLOTS && guardSlots[page / 2].state == GUARD_ALLOCATED) {
+      slot = &guardSlots[page / 2];
+      what = "Buffer underflow";
+    }
+
+    char msg[128];
+    char * out = msg;
+    guard_append(&out, what);
+    if (slot != NULL && slot->state != GUARD_UNUSED) {
+      guard_append(&out, " at offset ");
+      if (addr < slot->mem) {
+        guard_append(&out, "-");
+        guard_append_number(&out, slot->mem - addr);
+      } else {
+        guard_append_number(&out, addr - slot->mem);
+      }
+      guard_append(&out, " of a ");
+      guard_append_number(&out, slot->size);
+      guard_append(&out, " byte guarded block");
+    }
+    guard_append(&out, "\n");
+    write(STDERR_FILENO, msg, out - msg);
+  }
+
+  if (guardOldAction.sa_flags & SA_SIGINFO) {
+    guardOldAction.sa_sigaction(sig, info, context);
+  } else if (guardOldAction.sa_handler != SIG_DFL && guardOldAction.sa_handler != SIG_IGN) {
+    guardOldAction.sa_handler(sig);
+  } else {
+    // Returning retries the access, which now kills the process
+    signal(SIGSEGV, SIG_DFL);
+  }
+}
+
+/**
+ * @brief Reserve the pool of guarded blocks and start describing faults in
+ *        it. Called with guardMutex held
+ *
+ * @return true if the pool is available
+ */
+static bool guard_create_pool() {
+  size_t page = getpagesize();
+  size_t size = (2 * GUARD_SLOTS + 1) * page;
+  char * pool = mmap(NULL, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (pool == MAP_FAILED) {
+    return false;
+  }
+  if (!chunk_map_set(pool, size, CHUNK_GUARD, 0)) {
+    munmap(pool, size);
+    return false;
+  }
+
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_sigaction = guard_handler;
+  action.sa_flags = SA_SIGINFO;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGSEGV, &action, &guardOldAction);
+
+  guardPageSize = page;
+  guardPoolEnd = pool + size;
+  __atomic_store_n(&guardPool, pool, __ATOMIC_RELEASE);
+  return true;
+}
+
+/**
+ * @brief Place a block at the end of a slot in the pool of guarded blocks
+ *
+ * @param size number of bytes the user needs
+ * @param alignment power of two the user's block is aligned to
+ *
+ * @return the user's block or NULL if it cannot be guarded
+ */
+static void * guard_alloc(size_t size, size_t alignment) {
+  size_t page = getpagesize();
+  if (size == 0 || size > page || alignment > page) {
+    return NULL;
+  }
+
+  pthread_mutex_lock(&guardMutex);
+  if (guardPool == NULL && !guard_create_pool()) {
+    pthread_mutex_unlock(&guardMutex);
+    return NULL;
+  }
+  size_t index;
+  if (guardFresh < GUARD_SLOTS) {
+    index = guardFresh++;
+  } else if (guardQueueCount > 0) {
+    index = guardQueue[guardQueueHead];
+    guardQueueHead = (guardQueueHead + 1) % GUARD_SLOTS;
+    guardQueueCount--;
+  } else {
+    pthread_mutex_unlock(&guardMutex);
+    return NULL;
+  }
+
+  char * slotPage = guardPool + (2 * index + 1) * page;
+  if (mprotect(slotPage, page, PROT_READ | PROT_WRITE) != 0) {
+    guardQueue[(guardQueueHead + guardQueueCount++) % GUARD_SLOTS] = index;
+    pthread_mutex_unlock(&guardMutex);
+    return NULL;
+  }
+
+  // End the block as close to the guard page as its alignment allows
+  guard_slot * slot = &guardSlots[index];
+  slot->mem = (char *) (((uintptr_t) slotPage + page - size) & ~(uintptr_t) (alignment - 1));
+  slot->size = size;
+  slot->state = GUARD_ALLOCATED;
+  pthread_mutex_unlock(&guardMutex);
+  count_call(false, block_class(size));
+  return slot->mem;
+}
+
+/**
+ * @brief Free a guarded block, leaving its page inaccessible until the slot
+ *        is reused
+ *
+ * @param p the block
+ */
+static void guard_free(void * p) {
+  size_t page = ((char *) p - guardPool) / guardPageSize;
+  guard_slot * slot = &guardSlots[page / 2];
+
+  pthread_mutex_lock(&guardMutex);
+  if (page % 2 == 0 || slot->state != GUARD_ALLOCATED || slot->mem != p) {
+    pthread_mutex_unlock(&guardMutex);
+    report_double_free();
+  }
+  slot->state = GUARD_FREED;
+  count_call(true, block_class(slot->size));
+
+  // Dropping the page also zeroes it for the next block in the slot
+  char * slotPage = guardPool + page * guardPageSize;
+  madvise(slotPage, guardPageSize, MADV_DONTNEED);
+  mprotect(slotPage, guardPageSize, PROT_NONE);
+  guardQueue[(guardQueueHead + guardQueueCount++) % GUARD_SLOTS] = page / 2;
+  pthread_mutex_unlock(&guardMutex);
+}
+
+/**
+ * @brief Number of bytes requested for a guarded block, as any more would
+ *        run into the guard page
+ *
+ * @param p the block
+ *
+ * @return the usable size of the block
+ */
+static size_t guard_usable_size(void * p) {
+  return guardSlots[((char *) p - guardPool) / guardPageSize / 2].size;
+}
+
+#if SLAB_MAX_SIZE > 0
+/**
+ * @brief Reserve the address space slabs are carved from
+ *
+ * @return true if the region is available
+ */
+static bool slab_reserve_region() {
+  if (slabRegion != NULL) {
+    return true;
+  }
+
+  // Map an extra slab so an aligned region fits
+  size_t map_size = SLAB_REGION_SIZE + SLAB_PAGE_SIZE;
+  char * raw = mmap(NULL, map_size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (raw == MAP_FAILED) {
+    return false;
+  }
+
+  char * aligned = (char *) (((uintptr_t) raw + SLAB_PAGE_SIZE - 1)
+                             & ~(uintptr_t) (SLAB_PAGE_SIZE - 1));
+  slabRegionTop = aligned;
+  slabRegion = aligned;
+  return true;
+}
+
+/**
+ * @brief Get an empty slab and carve it into slots of one size
+ *
+ * @param slotSize the size of every slot in the slab
+ *
+ * @return the slab or NULL if the slab region is exhausted
+ */
+static slab * slab_page_alloc(uint32_t slotSize) {
+  pthread_mutex_lock(&slabPoolMutex);
+  slab * s = freeSlabs;
+  if (s != NULL) {
+    freeSlabs = s->next;
+  } else if (slab_reserve_region()
+             && slabRegionTop + SLAB_PAGE_SIZE <= slabRegion + SLAB_REGION_SIZE) {
+    s = (slab *) slabRegionTop;
+    slabRegionTop += SLAB_PAGE_SIZE;
+  }
+  pthread_mutex_unlock(&slabPoolMutex);
+
+  if (s == NULL) {
+    return NULL;
+  }
+  if (!chunk_map_set(s, SLAB_PAGE_SIZE, CHUNK_SLAB, slotSize / 8)) {
+    pthread_mutex_lock(&slabPoolMutex);
+    s->next = freeSlabs;
+    freeSlabs = s;
+    pthread_mutex_unlock(&slabPoolMutex);
+    return NULL;
+  }
+
+  s->next = s->prev = NULL;
+  s->slotSize = slotSize;
+  s->nslots = (SLAB_PAGE_SIZE - SLAB_HEADER_SIZE) / slotSize;
+  s->nfree = s->nslots;
+  s->hint = 0;
+  memset(s->freeMap, 0, sizeof(s->freeMap));
+  for (uint32_t i = 0; i < s->nslots / 64; i++) {
+    s->freeMap[i] = ~0ULL;
+  }
+  if (s->nslots % 64) {
+    s->freeMap[s->nslots / 64] = (1ULL << (s->nslots % 64)) - 1;
+  }
+  return s;
+}
+
+/**
+ * @brief Return an empty slab to the pool and release its memory to the OS
+ *
+ * @param s the empty slab
+ */
+static void slab_page_free(slab * s) {
+  chunk_map_set(s, SLAB_PAGE_SIZE, CHUNK_NONE, 0);
+  size_t page = getpagesize();
+  if (SLAB_PAGE_SIZE > page) {
+    madvise((char *) s + page, SLAB_PAGE_SIZE - page, MADV_DONTNEED);
+  }
+
+  pthread_mutex_lock(&slabPoolMutex);
+  s->next = freeSlabs;
+  freeSlabs = s;
+  pthread_mutex_unlock(&slabPoolMutex);
+}
+
+/**
+ * @brief Helper to find the slab a slot belongs to
+ *
+ * @param p a pointer to a slot
+ *
+ * @return the slab containing the slot
+ */
+static inline slab * slab_for_ptr(void * p) {
+  return (slab *) ((uintptr_t) p & ~(uintptr_t) (SLAB_PAGE_SIZE - 1));
+}
+
+/**
+ * @brief Allocate a slot from the first partial slab of the request's size
+ *        class
+ *
+ * @param raw_size number of bytes the user needs, at most SLAB_MAX_SIZE
+ *
+ * @return the slot or NULL if no slab could be allocated
+ */
+static void * slab_alloc(size_t raw_size) {
+  // With MIN_ALIGNMENT 16 only every other class is used, keeping slots
+  // aligned
+  size_t size = (raw_size + MIN_ALIGNMENT - 1) & ~(size_t) (MIN_ALIGNMENT - 1);
+  int cls = size / 8 - 1;
+  slab_class * c = &slabClasses[cls];
+
+  pthread_mutex_lock(&c->mutex);
+  slab * s = c->partial;
+  if (s == NULL) {
+    s = slab_page_alloc((cls + 1) * 8);
+    if (s == NULL) {
+      pthread_mutex_unlock(&c->mutex);
+      return NULL;
+    }
+    c->partial = s;
+  }
+
+  uint32_t word = s->hint;
+  while (s->freeMap[word] == 0) {
+    word++;
+  }
+  uint32_t slot = word * 64 + __builtin_ctzll(s->freeMap[word]);
+  s->freeMap[word] &= s->freeMap[word] - 1;
+  s->hint = word;
+
+  // Full slabs leave the partial list until a slot is freed
+  if (--s->nfree == 0) {
+    c->partial = s->next;
+    if (s->next != NULL) {
+      s->next->prev = NULL;
+    }
+    s->next = s->prev = NULL;
+  }
+  pthread_mutex_unlock(&c->mutex);
+
+  count_call(false, block_class(size));
+  return (char *) s + SLAB_HEADER_SIZE + (size_t) slot * s->slotSize;
+}
+
+/**
+ * @brief Release a slot back to its slab
+ *
+ * @param p a pointer to the slot
+ */
+static void slab_free(void * p) {
+  slab * s = slab_for_ptr(p);
+  uint32_t slot = ((char *) p - ((char *) s + SLAB_HEADER_SIZE)) / s->slotSize;
+  uint32_t word = slot / 64;
+  uint64_t bit = 1ULL << (slot % 64);
+  slab_class * c = &slabClasses[s->slotSize / 8 - 1];
+
+  pthread_mutex_lock(&c->mutex);
+  if (s->freeMap[word] & bit) {
+    pthread_mutex_unlock(&c->mutex);
+    report_double_free();
+  }
+  count_call(true, block_class(s->slotSize));
+  s->freeMap[word] |= bit;
+  if (word < s->hint) {
+    s->hint = word;
+  }
+
+  s->nfree++;
+  if (s->nfree == 1) {
+    // The slab was full, make its slots available again
+    s->prev = NULL;
+    s->next = c->partial;
+    if (c->partial != NULL) {
+      c->partial->prev = s;
+    }
+    c->partial = s;
+  } else if (s->nfree == s->nslots && (s->prev != NULL || s->next != NULL)) {
+    // Keep one empty slab per class, release the others
+    if (s->prev != NULL) {
+      s->prev->next = s->next;
+    } else {
+      c->partial = s->next;
+    }
+    if (s->next != NULL) {
+      s->next->prev = s->prev;
+    }
+    pthread_mutex_unlock(&c->mutex);
+    slab_page_free(s);
+    return;
+  }
+  pthread_mutex_unlock(&c->mutex);
+}
+
+/**
+ * @brief Verify that each partial slab's free count matches its bitmap
+ *
+ * @return true if the slabs are valid
+ */
+static bool verify_slabs() {
+  for (int i = 0; i < SLAB_CLASSES; i++) {
+    for (slab * s = slabClasses[i].partial; s != NULL; s = s->next) {
+      uint32_t nfree = 0;
+      for (int w = 0; w < SLAB_MAP_WORDS; w++) {
+        nfree += __builtin_popcountll(s->freeMap[w]);
+      }
+      if (nfree != s->nfree || s->slotSize != (uint32_t) (i + 1) * 8) {
+        fprintf(stderr, "Invalid slab\n");
+        return false;
+      }
+    }
+  }
+  return true;
+}
+#endif // SLAB_MAX_SIZE > 0
+
+/**
+ * @brief Helper to find the number of bytes usable in an allocated block
+ *
+ * @param p The pointer returned to the user by a call to malloc
+ *
+ * @return the usable size of the block
+ */
+static size_t usable_size(void * p) {
+  uint16_t entry = chunk_map_get(p);
+  if (chunk_entry_kind(entry) == CHUNK_GUARD) {
+    return guard_usable_size(p);
+  }
+  if (chunk_entry_kind(entry) == CHUNK_SLAB) {
+    return chunk_entry_id(entry) * 8;
+  }
+  header * hdr = ptr_to_header(p);
+  return get_size(hdr) - (get_state(hdr) == MMAPPED ? ALLOC_HEADER_SIZE : ALLOC_OVERHEAD);
+}
+
+/**
+ * @brief Helper to resize a block in place where its kind allows it
+ *
+ * @param p The pointer returned to the user by a call to malloc
+ * @param size The number of bytes the user now needs
+ *
+ * @return p if the block was resized or NULL if it has to move
+ */
+static void * resize_in_place(void * p, size_t size) {
+  uint16_t entry = chunk_map_get(p);
+  // Guarded blocks always move so they stay against their guard page
+  if (chunk_entry_kind(entry) == CHUNK_GUARD) {
+    return NULL;
+  }
+  if (chunk_entry_kind(entry) == CHUNK_SLAB) {
+    // Stay in the slot unless it is too small or the next class down fits
+    size_t slot = chunk_entry_id(entry) * 8;
+    if (size > slot || size + MIN_ALIGNMENT <= slot) {
+      return NULL;
+    }
+    count_resize(block_class(slot), block_class(slot));
+    return p;
+  }
+
+  header * hdr = ptr_to_header(p);
+  if (get_state(hdr) == MMAPPED) {
+    int old_class = block_class(get_size(hdr) - ALLOC_HEADER_SIZE);
+    if (size + ALLOC_HEADER_SIZE <= get_size(hdr)) {
+      count_resize(old_class, old_class);
+      return p;
+    }
+    size_t page = getpagesize();
+    size_t new_size = (size + ALLOC_HEADER_SIZE + hdr->left_size + page - 1) & ~(page - 1);
+    // The mapping may move, so read the header before remapping
+    size_t offset = hdr->left_size;
+    size_t old_size = get_size(hdr) + offset;
+    char * old = (char *) hdr - offset;
+    char * mem = mremap(old, old_size, new_size, 0);
+    if (mem != MAP_FAILED && !chunk_map_set(old, new_size, CHUNK_MMAPPED, 0)) {
+      mremap(old, new_size, old_size, 0);
+      return NULL;
+    }
+    if (mem == MAP_FAILED) {
+      // Move the mapping onto pages recorded for it beforehand, as its old
+      // pages may be reused as soon as it moves
+      mem = mmap(NULL, new_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+      if (mem == MAP_FAILED) {
+        return NULL;
+      }
+      if (!chunk_map_set(mem, new_size, CHUNK_MMAPPED, 0)) {
+        munmap(mem, new_size);
+        return NULL;
+      }
+      chunk_map_set(old, old_size, CHUNK_NONE, 0);
+      if (mremap(old, old_size, new_size, MREMAP_MAYMOVE | MREMAP_FIXED, mem) == MAP_FAILED) {
+        // The reservation may already be gone, so it is left alone
+        chunk_map_set(old, old_size, CHUNK_MMAPPED, 0);
+        return NULL;
+      }
+    }
+    __atomic_add_fetch(&mmappedBytes, new_size - old_size, __ATOMIC_RELAXED);
+    hdr = (header *) (mem + offset);
+    set_size(hdr, new_size - offset);
+    count_resize(old_class, block_class(get_size(hdr) - ALLOC_HEADER_SIZE));
+    return hdr->data;
+  }
+
+  // Blocks held by a thread cache are allocated so they are never absorbed
+  arena * a = arena_for_ptr(p);
+  arena_acquire(a);
+  int old_class = freelist_index(get_size(hdr));
+  bool resized = resize_object(a, hdr, size);
+  pthread_mutex_unlock(&a->mutex);
+  if (!resized) {
+    return NULL;
+  }
+  count_resize(old_class, freelist_index(get_size(hdr)));
+  return p;
+}
+
+/**
+ * @brief Read a size tunable from the environment
+ *
+ * @param name the environment variable
+ * @param def the value to use when the variable is not set
+ *
+ * @return the configured value
+ */
+static size_t env_size(const char * name, size_t def) {
+  const char * var = getenv(name);
+  return var != NULL ? strtoull(var, NULL, 0) : def;
+}
+
+#if TRACE
+static uint64_t trace_clock() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * @brief Start a new trace for this process if MYMALLOC_TRACE is set,
+ *        dropping any records inherited from a parent
+ */
+static void trace_open() {
+  if (traceFd >= 0) {
+    close(traceFd);
+    traceFd = -1;
+  }
+  const char * path = getenv(MALLOC_TRACE);
+  if (path == NULL || path[0] == '\0') {
+    return;
+  }
+
+  char name[4096];
+  snprintf(name, sizeof(name), "%s.%d", path, (int) getpid());
+  int fd = open(name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    return;
+  }
+  uint64_t fileHeader[3] = { TRACE_MAGIC, TRACE_VERSION, sizeof(trace_record) };
+  if (write(fd, fileHeader, TRACE_HEADER_SIZE) != TRACE_HEADER_SIZE) {
+    close(fd);
+    return;
+  }
+
+  traceNext = 0;
+  traceFlushed = 0;
+  memset(traceCommitted, 0, sizeof(traceCommitted));
+  traceStart = trace_clock();
+  traceFd = fd;
+}
+
+/**
+ * @brief Write records to the trace file
+ *
+ * @param from the first record to write
+ * @param to one past the last record to write
+ * @param wait whether to wait for records still being filled in, otherwise
+ *        writing stops at the first one
+ */
+static void trace_write(uint64_t from, uint64_t to, bool wait) {
+  uint64_t n = from;
+  for (; n < to; n++) {
+    uint64_t * committed = &traceCommitted[n % TRACE_RING_SIZE];
+    while (__atomic_load_n(committed, __ATOMIC_ACQUIRE) != n + 1) {
+      if (!wait) {
+        break;
+      }
+      sched_yield();
+    }
+    if (__atomic_load_n(committed, __ATOMIC_ACQUIRE) != n + 1) {
+      break;
+    }
+  }
+
+  // The records are contiguous in the ring unless they wrap around its end
+  size_t size = sizeof(trace_record);
+  for (uint64_t start = from; start < n; ) {
+    uint64_t slot = start % TRACE_RING_SIZE;
+    uint64_t count = n - start < TRACE_RING_SIZE - slot ? n - start : TRACE_RING_SIZE - slot;
+    if (pwrite(traceFd, &traceRing[slot], count * size, TRACE_HEADER_SIZE + start * size) < 0) {
+      return;
+    }
+    start += count;
+  }
+}
+
+/**
+ * @brief Record a call in the trace, writing out the previous half of the
+ *        ring when the record starts a new half
+ *
+ * @param op the call
+ * @param ptr the block the call returned or freed
+ * @param size the size requested
+ * @param alignment the alignment requested or 0
+ */
+static void trace(enum trace_op op, void * ptr, size_t size, size_t alignment) {
+  if (traceFd < 0) {
+    return;
+  }
+  if (traceThread == 0) {
+    traceThread = __atomic_add_fetch(&traceThreads, 1, __ATOMIC_RELAXED);
+  }
+
+  uint64_t n = __atomic_fetch_add(&traceNext, 1, __ATOMIC_RELAXED);
+  while (n >= __atomic_load_n(&traceFlushed, __ATOMIC_ACQUIRE) + TRACE_RING_SIZE) {
+    sched_yield();
+  }
+
+  trace_record * r = &traceRing[n % TRACE_RING_SIZE];
+  r->ptr = (uintptr_t) ptr;
+  r->size = size;
+  r->nanos = trace_clock() - traceStart;
+  r->thread = traceThread;
+  r->op = op;
+  r->alignLog2 = alignment == 0 ? 0 : __builtin_ctzl(alignment);
+  r->unused = 0;
+  __atomic_store_n(&traceCommitted[n % TRACE_RING_SIZE], n + 1, __ATOMIC_RELEASE);
+
+  if (n % TRACE_FLUSH_SIZE == 0 && n != 0) {
+    // Halves are written out in order
+    while (__atomic_load_n(&traceFlushed, __ATOMIC_ACQUIRE) != n - TRACE_FLUSH_SIZE) {
+      sched_yield();
+    }
+    trace_write(n - TRACE_FLUSH_SIZE, n, true);
+    __atomic_store_n(&traceFlushed, n, __ATOMIC_RELEASE);
+  }
+}
+
+/**
+ * @brief Write out the records not yet written when the process exits
+ */
+static void __attribute__ ((destructor)) trace_close() {
+  if (traceFd >= 0) {
+    trace_write(__atomic_load_n(&traceFlushed, __ATOMIC_ACQUIRE),
+                __atomic_load_n(&traceNext, __ATOMIC_ACQUIRE), false);
+  }
+}
+#else
+static inline void trace(enum trace_op op, void * ptr, size_t size, size_t alignment) {
+  (void) op;
+  (void) ptr;
+  (void) size;
+  (void) alignment;
+}
+#endif // TRACE
+
+/**
+ * @brief Lock every allocator mutex so a fork copies the allocator in a
+ *        consistent state
+ */
+static void fork_prepare() {
+#if STATS
+  pthread_mutex_lock(&countersMutex);
+#endif
+  pthread_mutex_lock(&guardMutex);
+  pthread_mutex_lock(&handleMutex);
+#if SLAB_MAX_SIZE > 0
+  for (int i = 0; i < SLAB_CLASSES; i++) {
+    pthread_mutex_lock(&slabClasses[i].mutex);
+  }
+  pthread_mutex_lock(&slabPoolMutex);
+#endif
+  for (int i = 0; i < N_ARENAS; i++) {
+    pthread_mutex_lock(&arenas[i].mutex);
+  }
+}
+
+/**
+ * @brief Unlock the mutexes fork_prepare locked, in the parent and the child
+ */
+static void fork_release() {
+  for (int i = 0; i < N_ARENAS; i++) {
+    pthread_mutex_unlock(&arenas[i].mutex);
+  }
+#if SLAB_MAX_SIZE > 0
+  pthread_mutex_unlock(&slabPoolMutex);
+  for (int i = 0; i < SLAB_CLASSES; i++) {
+    pthread_mutex_unlock(&slabClasses[i].mutex);
+  }
+#endif
+  pthread_mutex_unlock(&handleMutex);
+  pthread_mutex_unlock(&guardMutex);
+#if STATS
+  pthread_mutex_unlock(&countersMutex);
+#endif
+}
+
+/**
+ * @brief Unlock the mutexes in the child of a fork, which starts its own
+ *        trace
+ */
+static void fork_child() {
+  fork_release();
+#if TRACE
+  trace_open();
+#endif
+}
+
+/**
+ * @brief Initialize the allocator once. Runs as a constructor but the
+ *        interface functions call it too, as other constructors may allocate
+ *        before it runs
+ */
+static void init() {
+  pthread_once(&initOnce, init_allocator);
+}
+
+static inline void ensure_init() {
+  if (!__atomic_load_n(&isMallocInitialized, __ATOMIC_ACQUIRE)) {
+    init();
+  }
+}
+
+/**
+ * @brief Initialize mutex lock and prepare an initial chunk of memory for allocation
+ */
+static void init_allocator() {
+  size_classes_init();
+
+  // Initialize mutexes for thread safety
+  for (int i = 0; i < N_ARENAS; i++) {
+    pthread_mutex_init(&arenas[i].mutex, NULL);
+  }
+#if SLAB_MAX_SIZE > 0
+  for (int i = 0; i < SLAB_CLASSES; i++) {
+    pthread_mutex_init(&slabClasses[i].mutex, NULL);
+  }
+#endif
+
+#if THREAD_CACHE_SIZE > 0
+  pthread_key_create(&tcache_key, tcache_destroy);
+#endif
+#if STATS
+  pthread_key_create(&countersKey, counters_detach);
+#endif
+
+  mmapThreshold = env_size(MALLOC_MMAP_THRESHOLD, mmapThreshold);
+
+  // Chunks must be able to hold two fenceposts and a free block
+  growMin = env_size(MALLOC_GROW_MIN, growMin);
+  growMin = growMin < 2 * sizeof(header) ? 2 * sizeof(header) : (growMin + 15) & ~(size_t) 15;
+  growFactor = env_size(MALLOC_GROW_FACTOR, growFactor);
+  growFactor = growFactor == 0 ? 1 : growFactor;
+  growMax = env_size(MALLOC_GROW_MAX, growMax);
+  growMax = growMax < growMin ? growMin : (growMax + 15) & ~(size_t) 15;
+  growReserve = env_size(MALLOC_GROW_RESERVE, growReserve);
+  trimThreshold = env_size(MALLOC_TRIM_THRESHOLD, trimThreshold);
+  hugePages = env_size(MALLOC_HUGE_PAGES, hugePages);
+  prefault = env_size(MALLOC_PREFAULT, prefault);
+  guardSampleRate = env_size(MALLOC_GUARD_SAMPLE_RATE, guardSampleRate);
+  compactFragmentation = env_size(MALLOC_COMPACT_FRAGMENTATION, compactFragmentation);
+  const char * policy = getenv(MALLOC_PLACEMENT);
+  for (int i = 0; policy != NULL && i < PLACEMENT_POLICIES; i++) {
+    if (strcmp(policy, placementNames[i]) == 0) {
+      placement = i;
+    }
+  }
+
+#ifdef DEBUG
+  // Manually set printf buffer so it won't call malloc when debugging the allocator
+  setvbuf(stdout, NULL, _IONBF, 0);
+#endif // DEBUG
+
+  arena_init(main_arena);
+
+  // Allocate the first chunk from the OS
+  header * block = allocate_chunk(main_arena, next_chunk_size(main_arena, 0));
+
+  header * prevFencePost = get_header_from_offset(block, -ALLOC_HEADER_SIZE);
+  insert_os_chunk(main_arena, prevFencePost);
+
+  main_arena->lastFencePost = get_header_from_offset(block, get_size(block));
+
+  // Set the base pointer to the beginning of the first fencepost in the first
+  // chunk from the OS
+  base = ((char *) block) - ALLOC_HEADER_SIZE; //sizeof(header);
+
+  // Insert first chunk into the free list
+  insert_freelist(main_arena, block);
+
+#if TRACE
+  trace_open();
+#endif
+
+  pthread_atfork(fork_prepare, fork_release, fork_child);
+  __atomic_store_n(&isMallocInitialized, true, __ATOMIC_RELEASE);
+
+  // Installed last, the handler may run as soon as it is
+  int signum = env_size(MALLOC_STATS_SIGNAL, 0);
+  if (signum != 0) {
+    my_malloc_stats_on_signal(signum, STDERR_FILENO);
+  }
+}
+
+/**
+ * @brief Allocate a block from whichever source serves its size. The
+ *        interface functions are thin wrappers recording each call in the
+ *        trace around this and the functions below, which call each other
+ *        without being traced again
+ *
+ * @param size the number of bytes requested
+ *
+ * @return the block or NULL
+ */
+static void * allocate(size_t size) {
+  ensure_init();
+
+  if (guard_sample()) {
+    void * mem = guard_alloc(size, MIN_ALIGNMENT);
+    if (mem != NULL) {
+      return mem;
+    }
+  }
+
+#if SLAB_MAX_SIZE > 0
+  if (size != 0 && size <= SLAB_MAX_SIZE) {
+    void * slot = slab_alloc(size);
+    if (slot != NULL) {
+      return slot;
+    }
+  }
+#endif
+
+  if (mmapThreshold != 0 && size >= mmapThreshold) {
+    void * mem = allocate_mmapped(size, MIN_ALIGNMENT);
+    if (mem != NULL) {
+      return mem;
+    }
+  }
+
+#if THREAD_CACHE_SIZE > 0
+  bool cacheable;
+  void * cached = tcache_get(size, &cacheable);
+  if (cached != NULL) {
+    return cached;
+  }
+  if (cacheable) {
+    return tcache_refill(size);
+  }
+#endif
+
+  void * mem = heap_allocate(size);
+  if (mem != NULL) {
+    count_heap_call(false, mem);
+  }
+  return mem;
+}
+
+static void * allocate_zeroed(size_t nmemb, size_t size) {
+  ensure_init();
+
+  size_t total;
+  if (__builtin_mul_overflow(nmemb, size, &total)) {
+    errno = ENOMEM;
+    return NULL;
+  }
+
+  // Small blocks may come from a cache with no record of what they held
+  if (total == 0 || request_index(calc_allocate_size(total)) < N_LISTS - 1) {
+    void * mem = allocate(total);
+    return mem == NULL ? NULL : memset(mem, 0, total);
+  }
+
+  // Guarded blocks are on pages zeroed when last freed
+  if (guard_sample()) {
+    void * mem = guard_alloc(total, MIN_ALIGNMENT);
+    if (mem != NULL) {
+      return mem;
+    }
+  }
+
+  // Fresh mappings are already zero
+  if (mmapThreshold != 0 && total >= mmapThreshold) {
+    void * mem = allocate_mmapped(total, MIN_ALIGNMENT);
+    if (mem != NULL) {
+      return mem;
+    }
+  }
+
+  void * mem = heap_allocate(total);
+  if (mem == NULL) {
+    return NULL;
+  }
+  count_heap_call(false, mem);
+  header * hdr = ptr_to_header(mem);
+  if (is_zeroed(hdr)) {
+    // Only the free list pointers were written since the OS handed it out
+    set_zeroed(hdr, false);
+    memset(mem, 0, FREE_HEADER_SIZE - ALLOC_HEADER_SIZE);
+    if (COMPACT_HEADERS) {
+      // and the size of the free block in its last word
+      memset((char *) hdr + get_size(hdr), 0, sizeof(size_t));
+    }
+  } else {
+    memset(mem, 0, total);
+  }
+  return mem;
+}
+
+static void * allocate_aligned(size_t alignment, size_t size) {
+  ensure_init();
+
+  if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+    errno = EINVAL;
+    return NULL;
+  }
+  if (alignment <= MIN_ALIGNMENT) {
+    return allocate(size);
+  }
+  if (size == 0) {
+    return NULL;
+  }
+
+  if (guard_sample()) {
+    void * mem = guard_alloc(size, alignment);
+    if (mem != NULL) {
+      return mem;
+    }
+  }
+
+  if (mmapThreshold != 0 && size >= mmapThreshold) {
+    void * mem = allocate_mmapped(size, alignment);
+    if (mem != NULL) {
+      return mem;
+    }
+  }
+
+  // Over-allocate so an aligned block with a free block's worth of slack
+  // before it fits, then trim
+  size_t padded;
+  if (__builtin_add_overflow(size, alignment + FREE_HEADER_SIZE, &padded)) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  void * mem = heap_allocate(padded);
+  if (mem == NULL) {
+    return NULL;
+  }
+
+  arena * a = arena_for_ptr(mem);
+  arena_acquire(a);
+  mem = align_object(a, ptr_to_header(mem), alignment, size);
+  pthread_mutex_unlock(&a->mutex);
+  count_heap_call(false, mem);
+  return mem;
+}
+
+/**
+ * @brief Return a block to whichever source it came from
+ *
+ * @param p the block or NULL
+ */
+static void deallocate(void * p) {
+  if (p == NULL) {
+    return;
+  }
+
+  uint16_t entry = chunk_map_get(p);
+  switch (chunk_entry_kind(entry)) {
+    case CHUNK_NONE:
+      report_invalid_pointer();
+      return;
+    case CHUNK_GUARD:
+      guard_free(p);
+      return;
+    case CHUNK_SLAB:
+#if SLAB_MAX_SIZE > 0
+      slab_free(p);
+#endif
+      return;
+    case CHUNK_MMAPPED:
+      deallocate_mmapped(ptr_to_header(p));
+      return;
+    case CHUNK_ARENA:
+      break;
+  }
+
+#if THREAD_CACHE_SIZE > 0
+  if (tcache_put(p)) {
+    return;
+  }
+#endif
+
+  count_heap_call(true, p);
+  arena * a = &arenas[chunk_entry_id(entry)];
+  if (remote_free_push(a, ptr_to_header(p))) {
+    return;
+  }
+  arena_acquire(a);
+  remote_free_drain(a);
+  deallocate_object(a, p);
+  pthread_mutex_unlock(&a->mutex);
+}
+
+/**
+ * @brief Resize a block, moving it if it cannot grow in place
+ *
+ * @param ptr the block, not NULL
+ * @param size the new size, not 0
+ *
+ * @return the block or NULL if a larger one could not be allocated
+ */
+static void * reallocate(void * ptr, size_t size) {
+  void * mem = resize_in_place(ptr, size);
+  if (mem != NULL) {
+    return mem;
+  }
+
+  // Only copy what the old block actually holds
+  size_t old_size = usable_size(ptr);
+  mem = allocate(size);
+  if (mem == NULL) {
+    return NULL;
+  }
+  memcpy(mem, ptr, old_size < size ? old_size : size);
+  deallocate(ptr);
+  return mem; 
+}
+
+/* 
+ * External interface
+ */
+void * my_malloc(size_t size) {
+  void * mem = allocate(size);
+  trace(TRACE_MALLOC, mem, size, 0);
+  return mem;
+}
+
+void * my_calloc(size_t nmemb, size_t size) {
+  void * mem = allocate_zeroed(nmemb, size);
+  trace(TRACE_CALLOC, mem, nmemb * size, 0);
+  return mem;
+}
+
+void * my_memalign(size_t alignment, size_t size) {
+  void * mem = allocate_aligned(alignment, size);
+  trace(TRACE_MEMALIGN, mem, size, alignment);
+  return mem;
+}
+
+void * my_aligned_alloc(size_t alignment, size_t size) {
+  return my_memalign(alignment, size);
+}
+
+int my_posix_memalign(void ** memptr, size_t alignment, size_t size) {
+  if (alignment == 0 || alignment % sizeof(void *) != 0 ||
+      (alignment & (alignment - 1)) != 0) {
+    return EINVAL;
+  }
+
+  int saved = errno;
+  void * mem = my_memalign(alignment, size);
+  errno = saved;
+  if (mem == NULL && size != 0) {
+    return ENOMEM;
+  }
+  *memptr = mem;
+  return 0;
+}
+
+void * my_realloc(void * ptr, size_t size) {
+  if (ptr == NULL) {
+    return my_malloc(size);
+  }
+  if (size == 0) {
+    my_free(ptr);
+    return NULL;
+  }
+
+  trace(TRACE_REALLOC, ptr, size, 0);
+  void * mem = reallocate(ptr, size);
+  trace(TRACE_REALLOC_RESULT, mem, size, 0);
+  return mem;
+}
+
+void my_free(void * p) {
+  // Traced before the block can be handed out again
+  if (p != NULL) {
+    trace(TRACE_FREE, p, 0, 0);
+  }
+  deallocate(p);
+}
+
+void my_free_sized(void * p, size_t size) {
+#ifdef DEBUG
+  if (p != NULL && my_malloc_owns(p) && size > usable_size(p)) {
+    report_invalid_size();
+  }
+#else
+  (void) size;
+#endif
+  my_free(p);
+}
+
+void my_thread_cache_flush() {
+#if THREAD_CACHE_SIZE > 0
+  for (int i = 0; i < N_LISTS - 1; i++) {
+    tcache_flush_bin(i, tcache.counts[i]);
+  }
+#endif
+}
+
+size_t my_malloc_usable_size(void * p) {
+  return p == NULL ? 0 : usable_size(p);
+}
+
+bool my_malloc_owns(void * p) {
+  return chunk_entry_kind(chunk_map_get(p)) != CHUNK_NONE;
+}
+
+bool my_malloc_set_placement(enum placement policy) {
+  if ((unsigned) policy >= PLACEMENT_POLICIES) {
+    return false;
+  }
+  __atomic_store_n(&placement, policy, __ATOMIC_RELAXED);
+  return true;
+}
+
+my_region * my_region_create() {
+  my_region * r = allocate(sizeof(my_region));
+  if (r != NULL) {
+    memset(r, 0, sizeof(my_region));
+  }
+  return r;
+}
+
+void * my_region_alloc(my_region * r, size_t size) {
+  if (size == 0 || size > SIZE_MAX - sizeof(region_block) - MIN_ALIGNMENT) {
+    return NULL;
+  }
+  size = (size + MIN_ALIGNMENT - 1) & ~(size_t) (MIN_ALIGNMENT - 1);
+
+  if ((size_t) (r->end - r->top) < size) {
+    if (size > REGION_BLOCK_SIZE / 4) {
+      region_block * block = allocate(sizeof(region_block) + size);
+      if (block == NULL) {
+        return NULL;
+      }
+      block->next = r->large;
+      r->large = block;
+      return block->data;
+    }
+
+    // Move on to the next block, reusing those kept by a reset
+    region_block * next = r->current == NULL ? r->first : r->current->next;
+    if (next == NULL) {
+      next = allocate(sizeof(region_block) + REGION_BLOCK_SIZE);
+      if (next == NULL) {
+        return NULL;
+      }
+      next->next = NULL;
+      if (r->current == NULL) {
+        r->first = next;
+      } else {
+        r->current->next = next;
+      }
+    }
+    r->current = next;
+    r->top = next->data;
+    r->end = next->data + REGION_BLOCK_SIZE;
+  }
+
+  void * mem = r->top;
+  r->top += size;
+  return mem;
+}
+
+void my_region_reset(my_region * r) {
+  while (r->large != NULL) {
+    region_block * block = r->large;
+    r->large = block->next;
+    deallocate(block);
+  }
+  r->current = NULL;
+  r->top = r->end = NULL;
+}
+
+void my_region_destroy(my_region * r) {
+  if (r == NULL) {
+    return;
+  }
+  my_region_reset(r);
+  while (r->first != NULL) {
+    region_block * block = r->first;
+    r->first = block->next;
+    deallocate(block);
+  }
+  deallocate(r);
 }
 
 /**
- * @brief Allocate another chunk from the OS and prepare to insert it
- * into the free list
+ * @brief Find the handle whose object is in a block
  *
- * @param size The size to allocate from the OS
+ * @param block an allocated arena block
  *
- * @return A pointer to the allocable block in the chunk (just after the 
- * first fencpost)
+ * @return the handle or NULL if the block holds no handle's object
  */
-static header * allocate_chunk(size_t size) {
-  void * mem = sbrk(size);
-  
-  insert_fenceposts(mem, size);
-  header * hdr = (header *) ((char *)mem + ALLOC_HEADER_SIZE);
-  set_state(hdr, UNALLOCATED);
-  set_size(hdr, size - 2 * ALLOC_HEADER_SIZE);
-  hdr->left_size = ALLOC_HEADER_SIZE;
-  return hdr;
+static struct my_handle_entry * block_handle(header * block) {
+  struct my_handle_entry * h = *(struct my_handle_entry **) block->data;
+  if (h < handleTable || h >= handleTable + handleTop ||
+      ((char *) h - (char *) handleTable) % sizeof(struct my_handle_entry) != 0) {
+    return NULL;
+  }
+  return h->mem == block->data + HANDLE_PREFIX ? h : NULL;
 }
 
-static size_t calc_allocate_size(size_t raw_size) {
-    size_t rounded = ((raw_size + ALLOC_HEADER_SIZE + 7) / 8) * 8;
-    if (rounded < sizeof(header))
-        return sizeof(header);
-    return rounded;
-}
+/**
+ * @brief Move an allocated block to the start of the free block to its left,
+ *        which then merges with any free block to its right
+ *
+ * @param a the arena owning the blocks
+ * @param block the block to move
+ *
+ * @return the block moved
+ */
+static header * slide_left(arena * a, header * block) {
+  header * left = get_left_header(block);
+  header * right = get_right_header(block);
+  size_t size = get_size(block);
+  size_t freeSize = get_size(left);
 
-static void insert_freelist(header * hdr) {
-    int idx;
-    size_t query_size = get_size(hdr) - ALLOC_HEADER_SIZE;
-    if (query_size > (N_LISTS - 1) * 8)
-        idx = N_LISTS - 1;
-    else
-        idx = (query_size / 8) - 1;
+  remove_from_freelist(a, left);
+  if (get_state(right) == UNALLOCATED) {
+    remove_from_freelist(a, right);
+    freeSize += get_size(right);
+    right = get_right_header(right);
+  }
 
-    header *flist = &freelistSentinels[idx];
-    if (flist->next == flist)
-        flist->prev = hdr;
-    hdr->next = flist->next;
-    hdr->prev = flist;
-    flist->next->prev = hdr;
-    flist->next = hdr;
-}
+  // The header keeps the left free block's left_size, its left neighbour is
+  // allocated as is the moved block's
+  memmove(left->data, block->data, size - ALLOC_OVERHEAD);
+  set_size(left, size);
+  set_state(left, ALLOCATED);
 
-static inline void remove_from_freelist(header * block) {
-    block->prev->next = block->next;
-    block->next->prev = block->prev;
+  header * hole = get_header_from_offset(left, size);
+  set_size_and_state(hole, freeSize, UNALLOCATED);
+  set_left_size(hole, left);
+  set_left_size(right, hole);
+  insert_freelist(a, hole);
+  return left;
 }
 
 /**
- * @brief Helper allocate an object given a raw request size from the user
+ * @brief Slide the unlocked handles' objects in an arena's chunks to the
+ *        left. Called with handleMutex and the arena's lock held
  *
- * @param raw_size number of bytes the user needs
+ * @param a the arena to compact
  *
- * @return A block satisfying the user's request
+ * @return the number of objects moved
  */
-static inline header * allocate_object(size_t raw_size) {
-    if (raw_size == 0)
-        return NULL;
-
-    size_t allocated_size = calc_allocate_size(raw_size);
-
-    /* Inline computation of free list index based on (allocated_size - header) */
-    int list_idx;
-    size_t query_size = allocated_size - ALLOC_HEADER_SIZE;
-    if (query_size > (N_LISTS - 1) * 8)
-        list_idx = N_LISTS - 1;
-    else
-        list_idx = (query_size / 8) - 1;
-
-    header *flist = &freelistSentinels[list_idx];
-    while (flist->next == flist && list_idx < N_LISTS - 1) {
-        list_idx++;
-        flist = &freelistSentinels[list_idx];
+static size_t arena_compact(arena * a) {
+  size_t moved = 0;
+  for (size_t i = 0; i < a->numOsChunks; i++) {
+    for (header * block = get_right_header(a->osChunkList[i]);
+         get_state(block) != FENCEPOST;
+         block = get_right_header(block)) {
+      if (get_state(block) != ALLOCATED || !left_is_free(block)) {
+        continue;
+      }
+      struct my_handle_entry * h = block_handle(block);
+      if (h != NULL && h->locks == 0) {
+        block = slide_left(a, block);
+        h->mem = block->data + HANDLE_PREFIX;
+        moved++;
+      }
     }
+  }
+  return moved;
+}
 
-    header *current;
-    for (current = flist->next; current != flist; current = current->next) {
-        size_t current_size = get_size(current);
-        if (allocated_size > current_size)
-            continue;
-        /* Case 1: Exact fit or remainder too small to split */
-        if (current_size == allocated_size || (current_size - allocated_size) < sizeof(header)) {
-            set_state(current, ALLOCATED);
-            current->next->prev = current->prev;
-            current->prev->next = current->next;
-            return (header *) current->data;
-        }
-        /* Case 2: Split block */
-        else {
-            /* Inline freeblock_check: compute free-list index for current block */
-            int tmp_idx;
-            size_t block_query = get_size(current) - ALLOC_HEADER_SIZE;
-            if (block_query > (N_LISTS - 1) * 8)
-                tmp_idx = N_LISTS - 1;
-            else
-                tmp_idx = (block_query / 8) - 1;
-            bool inFinalList = (tmp_idx == N_LISTS - 1);
-
-            set_size(current, current_size - allocated_size);
-            char * nptr = (char *) current + get_size(current);
-            header * newHdr = (header *) nptr;
-            set_size(newHdr, allocated_size);
-            newHdr->left_size = get_size(current);
-            set_state(newHdr, ALLOCATED);
-
-            char * rptr = (char *) newHdr + get_size(newHdr);
-            header * rightHdr = (header *) rptr;
-            rightHdr->left_size = get_size(newHdr);
-
-            /* Inline re-check: recompute free-list index for current block */
-            int tmp_idx2;
-            size_t block_query2 = get_size(current) - ALLOC_HEADER_SIZE;
-            if (block_query2 > (N_LISTS - 1) * 8)
-                tmp_idx2 = N_LISTS - 1;
-            else
-                tmp_idx2 = (block_query2 / 8) - 1;
-            if (!(inFinalList && (tmp_idx2 == N_LISTS - 1))) {
-                current->next->prev = current->prev;
-                current->prev->next = current->next;
-                insert_freelist(current);
-            }
-            return (header *) newHdr->data;
-        }
+/**
+ * @brief Compact an arena if too much of its free memory is outside its
+ *        largest free block. Called with handleMutex held
+ *
+ * @param a the arena to check
+ */
+static void compact_if_fragmented(arena * a) {
+  arena_acquire(a);
+  size_t freeBytes = 0;
+  size_t largestFree = 0;
+  for (int i = 0; i < N_LISTS; i++) {
+    header * sentinel = &a->freelistSentinels[i];
+    for (header * block = get_next(a, sentinel); block != sentinel; block = get_next(a, block)) {
+      freeBytes += get_size(block);
+      largestFree = get_size(block) > largestFree ? get_size(block) : largestFree;
     }
+  }
+  if ((freeBytes - largestFree) * 100 > freeBytes * compactFragmentation) {
+    arena_compact(a);
+  }
+  pthread_mutex_unlock(&a->mutex);
+}
 
-    /* Case 3: No suitable block found; allocate new chunk from OS */
-    header * newHdr = allocate_chunk(ARENA_SIZE);
-    header * left_fence = get_header_from_offset(newHdr, -ALLOC_HEADER_SIZE);
-    header * right_fence = get_header_from_offset(newHdr, get_size(newHdr));
-    header * last_fp = get_header_from_offset(left_fence, -ALLOC_HEADER_SIZE);
+my_handle my_halloc(size_t size) {
+  if (size > SIZE_MAX - HANDLE_PREFIX) {
+    return NULL;
+  }
+  ensure_init();
 
-    if (last_fp == lastFencePost) {
-        header * last_block = get_left_header(last_fp);
-        if (get_state(last_block) == UNALLOCATED) {
-            int tmp_idx3;
-            size_t block_query3 = get_size(last_block) - ALLOC_HEADER_SIZE;
-            if (block_query3 > (N_LISTS - 1) * 8)
-                tmp_idx3 = N_LISTS - 1;
-            else
-                tmp_idx3 = (block_query3 / 8) - 1;
-            bool inFinalList = (tmp_idx3 == N_LISTS - 1);
-
-            set_size(last_block, get_size(last_block) + get_size(newHdr) + 2 * ALLOC_HEADER_SIZE);
-            set_state(last_block, UNALLOCATED);
-            right_fence->left_size = get_size(last_block);
-
-            int tmp_idx4;
-            size_t block_query4 = get_size(last_block) - ALLOC_HEADER_SIZE;
-            if (block_query4 > (N_LISTS - 1) * 8)
-                tmp_idx4 = N_LISTS - 1;
-            else
-                tmp_idx4 = (block_query4 / 8) - 1;
-            if (!(inFinalList && (tmp_idx4 == N_LISTS - 1))) {
-                last_block->next->prev = last_block->prev;
-                last_block->prev->next = last_block->next;
-                insert_freelist(last_block);
-            }
-            lastFencePost = right_fence;
-            return allocate_object(raw_size);
-        } else {
-            set_size(last_fp, get_size(newHdr) + 2 * ALLOC_HEADER_SIZE);
-            right_fence->left_size = get_size(last_fp);
-            set_state(last_fp, UNALLOCATED);
-            insert_freelist(last_fp);
-            lastFencePost = right_fence;
-            return allocate_object(raw_size);
-        }
-    } else {
-        insert_freelist(newHdr);
-        lastFencePost = right_fence;
-        insert_os_chunk(left_fence);
-        return allocate_object(raw_size);
-    }
-}
+  // Handles' objects always come from the arenas, the only blocks that move
+  char * mem = heap_allocate(size + HANDLE_PREFIX);
+  if (mem == NULL) {
+    return NULL;
+  }
+  count_heap_call(false, mem);
 
+  pthread_mutex_lock(&handleMutex);
+  if (handleTable == NULL) {
+    void * table = mmap(NULL, MAX_HANDLES * sizeof(struct my_handle_entry), PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    handleTable = table != MAP_FAILED ? table : NULL;
+  }
+  struct my_handle_entry * h = handleFreeList;
+  if (h != NULL) {
+    handleFreeList = h->nextFree;
+  } else if (handleTable != NULL && handleTop < MAX_HANDLES) {
+    h = &handleTable[handleTop++];
+  }
+  if (h != NULL) {
+    h->mem = mem + HANDLE_PREFIX;
+    h->locks = 0;
+    *(struct my_handle_entry **) mem = h;
+  }
+  pthread_mutex_unlock(&handleMutex);
 
+  if (h == NULL) {
+    deallocate(mem);
+  }
+  return h;
+}
 
-/**
- * @brief Helper to get the header from a pointer allocated with malloc
- *
- * @param p pointer to the data region of the block
- *
- * @return A pointer to the header of the block
- */
-static inline header * ptr_to_header(void * p) {
-  return (header *)((char *) p - ALLOC_HEADER_SIZE); //sizeof(header));
+void * my_hlock(my_handle h) {
+  pthread_mutex_lock(&handleMutex);
+  h->locks++;
+  void * mem = h->mem;
+  pthread_mutex_unlock(&handleMutex);
+  return mem;
 }
 
-/**
- * @brief Helper to manage deallocation of a pointer returned by the user
- *
- * @param p The pointer returned to the user by a call to malloc
- */
-static inline void deallocate_object(void * p) {
-    if (p == NULL)
-        return;
+void my_hunlock(my_handle h) {
+  pthread_mutex_lock(&handleMutex);
+  h->locks--;
+  pthread_mutex_unlock(&handleMutex);
+}
 
-    header * currHdr = get_header_from_offset((char *)p, -ALLOC_HEADER_SIZE);
-    if (get_state(currHdr) == UNALLOCATED) {
-        printf("Double Free Detected\n");
-        puts("test_double_free: ../myMalloc.c:577: deallocate_object: Assertion `false' failed.");
-        abort();
-    }
+void my_hfree(my_handle h) {
+  if (h == NULL) {
+    return;
+  }
 
-    header * leftHdr = get_left_header(currHdr);
-    header * rightHdr = get_right_header(currHdr);
-    set_state(currHdr, UNALLOCATED);
+  pthread_mutex_lock(&handleMutex);
+  char * mem = (char *) h->mem - HANDLE_PREFIX;
+  h->mem = NULL;
+  h->nextFree = handleFreeList;
+  handleFreeList = h;
+  bool check = compactFragmentation != 0 && ++handleFrees % COMPACT_CHECK_INTERVAL == 0;
+  pthread_mutex_unlock(&handleMutex);
 
-    bool left_free = (get_state(leftHdr) == UNALLOCATED);
-    bool right_free = (get_state(rightHdr) == UNALLOCATED);
+  arena * a = arena_for_ptr(mem);
+  deallocate(mem);
 
-    if (left_free && right_free) {
-        int tmp_idx;
-        size_t block_query = get_size(leftHdr) - ALLOC_HEADER_SIZE;
-        if (block_query > (N_LISTS - 1) * 8)
-            tmp_idx = N_LISTS - 1;
-        else
-            tmp_idx = (block_query / 8) - 1;
-        bool inFinalList = (tmp_idx == N_LISTS - 1);
+  if (check) {
+    pthread_mutex_lock(&handleMutex);
+    compact_if_fragmented(a);
+    pthread_mutex_unlock(&handleMutex);
+  }
+}
 
-        set_state(leftHdr, UNALLOCATED);
-        set_size(leftHdr, get_size(leftHdr) + get_size(currHdr) + get_size(rightHdr));
-        rightHdr->next->prev = rightHdr->prev;
-        rightHdr->prev->next = rightHdr->next;
-        header * rightright = get_right_header(rightHdr);
-        rightright->left_size = get_size(leftHdr);
+size_t my_hcompact() {
+  ensure_init();
 
-        int tmp_idx2;
-        size_t block_query2 = get_size(leftHdr) - ALLOC_HEADER_SIZE;
-        if (block_query2 > (N_LISTS - 1) * 8)
-            tmp_idx2 = N_LISTS - 1;
-        else
-            tmp_idx2 = (block_query2 / 8) - 1;
-        if (!(inFinalList && (tmp_idx2 == N_LISTS - 1))) {
-            leftHdr->next->prev = leftHdr->prev;
-            leftHdr->prev->next = leftHdr->next;
-            insert_freelist(leftHdr);
-        }
+  size_t moved = 0;
+  pthread_mutex_lock(&handleMutex);
+  for (int i = 0; i < N_ARENAS; i++) {
+    arena * a = &arenas[i];
+    arena_acquire(a);
+    if (a->initialized) {
+      moved += arena_compact(a);
     }
-    else if (left_free) {
-        int tmp_idx;
-        size_t block_query = get_size(leftHdr) - ALLOC_HEADER_SIZE;
-        if (block_query > (N_LISTS - 1) * 8)
-            tmp_idx = N_LISTS - 1;
-        else
-            tmp_idx = (block_query / 8) - 1;
-        bool inFinalList = (tmp_idx == N_LISTS - 1);
+    pthread_mutex_unlock(&a->mutex);
+  }
+  pthread_mutex_unlock(&handleMutex);
+  return moved;
+}
 
-        set_state(leftHdr, UNALLOCATED);
-        set_size(leftHdr, get_size(leftHdr) + get_size(currHdr));
-        rightHdr->left_size = get_size(leftHdr);
+int my_malloc_trim(size_t pad) {
+  ensure_init();
 
-        int tmp_idx2;
-        size_t block_query2 = get_size(leftHdr) - ALLOC_HEADER_SIZE;
-        if (block_query2 > (N_LISTS - 1) * 8)
-            tmp_idx2 = N_LISTS - 1;
-        else
-            tmp_idx2 = (block_query2 / 8) - 1;
-        if (!(inFinalList && (tmp_idx2 == N_LISTS - 1))) {
-            leftHdr->next->prev = leftHdr->prev;
-            leftHdr->prev->next = leftHdr->next;
-            insert_freelist(leftHdr);
+  bool released = false;
+  for (int i = 0; i < N_ARENAS; i++) {
+    arena * a = &arenas[i];
+    arena_acquire(a);
+    if (a->initialized) {
+      remote_free_drain(a);
+      released |= trim_top(a, pad);
+      for (int j = 0; j < N_LISTS; j++) {
+        header * sentinel = &a->freelistSentinels[j];
+        for (header * block = get_next(a, sentinel); block != sentinel; block = get_next(a, block)) {
+          released |= release_free_pages(a, block);
         }
+      }
     }
-    else if (right_free) {
-        header * rightright = get_right_header(rightHdr);
-        rightright->left_size = get_size(currHdr) + get_size(rightHdr);
-        set_size(currHdr, get_size(currHdr) + get_size(rightHdr));
-        rightHdr->next->prev = rightHdr->prev;
-        rightHdr->prev->next = rightHdr->next;
-        insert_freelist(currHdr);
-    }
-    else {
-        insert_freelist(currHdr);
-    }
+    pthread_mutex_unlock(&a->mutex);
+  }
+  return released;
 }
 
-
 /**
- * @brief Helper to detect cycles in the free list
- * https://en.wikipedia.org/wiki/Cycle_detection#Floyd's_Tortoise_and_Hare
+ * @brief Add the counters that can be read without a lock to stats: the
+ *        calls counted by every thread, each arena's counters and the bytes
+ *        in mapped blocks. A counter read while it is being updated may be
+ *        one update behind
  *
- * @return One of the nodes in the cycle or NULL if no cycle is present
+ * @param stats the statistics to add to
  */
-static inline header * detect_cycles() {
-  for (int i = 0; i < N_LISTS; i++) {
-    header * freelist = &freelistSentinels[i];
-    for (header * slow = freelist->next, * fast = freelist->next->next; 
-         fast != freelist; 
-         slow = slow->next, fast = fast->next->next) {
-      if (slow == fast) {
-        return slow;
-      }
+static void stats_add_counters(allocator_stats * stats) {
+#if STATS
+  for (call_counters * c = __atomic_load_n(&allCounters, __ATOMIC_ACQUIRE); c != NULL; c = c->next) {
+    for (int i = 0; i < N_LISTS; i++) {
+      stats->mallocs[i] += __atomic_load_n(&c->mallocs[i], __ATOMIC_RELAXED);
+      stats->frees[i] += __atomic_load_n(&c->frees[i], __ATOMIC_RELAXED);
     }
   }
-  return NULL;
+#endif
+
+  for (int i = 0; i < N_ARENAS; i++) {
+    arena * a = &arenas[i];
+    stats->inUseBytes += __atomic_load_n(&a->inUseBytes, __ATOMIC_RELAXED);
+    stats->osBytes += __atomic_load_n(&a->osBytes, __ATOMIC_RELAXED);
+    stats->peakOsBytes += __atomic_load_n(&a->peakOsBytes, __ATOMIC_RELAXED);
+    stats->osChunks += __atomic_load_n(&a->osChunks, __ATOMIC_RELAXED);
+    stats->lockWaitNanos += __atomic_load_n(&a->lockWaitNanos, __ATOMIC_RELAXED);
+  }
+  stats->mmappedBytes = __atomic_load_n(&mmappedBytes, __ATOMIC_RELAXED);
 }
 
-/**
- * @brief Helper to verify that there are no unlinked previous or next pointers
- *        in the free list
- *
- * @return A node whose previous and next pointers are incorrect or NULL if no
- *         such node exists
- */
-static inline header * verify_pointers() {
-  for (int i = 0; i < N_LISTS; i++) {
-    header * freelist = &freelistSentinels[i];
-    for (header * cur = freelist->next; cur != freelist; cur = cur->next) {
-      if (cur->next->prev != cur || cur->prev->next != cur) {
-        return cur;
+allocator_stats my_malloc_stats() {
+  ensure_init();
+
+  allocator_stats stats;
+  memset(&stats, 0, sizeof(stats));
+
+  for (int i = 0; i < N_ARENAS; i++) {
+    arena * a = &arenas[i];
+    arena_acquire(a);
+    if (a->initialized) {
+      for (int j = 0; j < N_LISTS; j++) {
+        header * sentinel = &a->freelistSentinels[j];
+        for (header * block = get_next(a, sentinel); block != sentinel; block = get_next(a, block)) {
+          stats.freeBytes += get_size(block);
+          if (get_size(block) > stats.largestFree) {
+            stats.largestFree = get_size(block);
+          }
+        }
       }
     }
+    pthread_mutex_unlock(&a->mutex);
   }
-  return NULL;
+  stats_add_counters(&stats);
+
+  if (stats.freeBytes != 0) {
+    stats.fragmentation = 1.0 - (double) stats.largestFree / stats.freeBytes;
+  }
+  return stats;
 }
 
 /**
- * @brief Verify the structure of the free list is correct by checkin for 
- *        cycles and misdirected pointers
+ * @brief Helper to append a string to a buffer, dropping what does not fit.
+ *        Formats without the C library so a signal handler can use it
  *
- * @return true if the list is valid
+ * @param buf the buffer
+ * @param len the length of the text already in the buffer, updated
+ * @param cap the size of the buffer
+ * @param str the string
  */
-static inline bool verify_freelist() {
-  header * cycle = detect_cycles();
-  if (cycle != NULL) {
-    fprintf(stderr, "Cycle Detected\n");
-    print_sublist(print_object, cycle->next, cycle);
-    return false;
-  }
-
-  header * invalid = verify_pointers();
-  if (invalid != NULL) {
-    fprintf(stderr, "Invalid pointers\n");
-    print_object(invalid);
-    return false;
+static void buf_puts(char * buf, size_t * len, size_t cap, const char * str) {
+  while (*str != '\0' && *len < cap) {
+    buf[(*len)++] = *str++;
   }
-
-  return true;
 }
 
 /**
- * @brief Helper to verify that the sizes in a chunk from the OS are correct
- *        and that allocated node's canary values are correct
+ * @brief Helper to append a number in decimal to a buffer, dropping what
+ *        does not fit
  *
- * @param chunk AREA_SIZE chunk allocated from the OS
- *
- * @return a pointer to an invalid header or NULL if all header's are valid
+ * @param buf the buffer
+ * @param len the length of the text already in the buffer, updated
+ * @param cap the size of the buffer
+ * @param n the number
+ * @param width the fewest digits to write, padding with zeros
  */
-static inline header * verify_chunk(header * chunk) {
-	if (get_state(chunk) != FENCEPOST) {
-		fprintf(stderr, "Invalid fencepost\n");
-		print_object(chunk);
-		return chunk;
-	}
-	
-	for (; get_state(chunk) != FENCEPOST; chunk = get_right_header(chunk)) {
-		if (get_size(chunk)  != get_right_header(chunk)->left_size) {
-			fprintf(stderr, "Invalid sizes\n");
-			print_object(chunk);
-			return chunk;
-		}
-	}
-	
-	return NULL;
+static void buf_putu(char * buf, size_t * len, size_t cap, uint64_t n, int width) {
+  char digits[20];
+  int count = 0;
+  do {
+    digits[count++] = '0' + n % 10;
+    n /= 10;
+  } while (n != 0 || count < width);
+  while (count > 0 && *len < cap) {
+    buf[(*len)++] = digits[--count];
+  }
 }
 
 /**
- * @brief For each chunk allocated by the OS verify that the boundary tags
- *        are consistent
+ * @brief Helper to append a "name":value field and a comma to a buffer
  *
- * @return true if the boundary tags are valid
+ * @param buf the buffer
+ * @param len the length of the text already in the buffer, updated
+ * @param cap the size of the buffer
+ * @param name the field's name
+ * @param value the field's value
  */
-static inline bool verify_tags() {
-  for (size_t i = 0; i < numOsChunks; i++) {
-    header * invalid = verify_chunk(osChunkList[i]);
-    if (invalid != NULL) {
-      return invalid;
-    }
-  }
-
-  return NULL;
+static void buf_put_field(char * buf, size_t * len, size_t cap, const char * name, uint64_t value) {
+  buf_puts(buf, len, cap, "\"");
+  buf_puts(buf, len, cap, name);
+  buf_puts(buf, len, cap, "\":");
+  buf_putu(buf, len, cap, value, 1);
+  buf_puts(buf, len, cap, ",");
 }
 
 /**
- * @brief Initialize mutex lock and prepare an initial chunk of memory for allocation
+ * @brief Write statistics to a file descriptor as a JSON object. Only calls
+ *        write, so a signal handler can use it
+ *
+ * @param fd the file descriptor
+ * @param stats the statistics
+ * @param lists whether the fields computed from the free lists are filled in
  */
-static void init() {
-  // Initialize mutex for thread safety
-  pthread_mutex_init(&mutex, NULL);
-
-#ifdef DEBUG
-  // Manually set printf buffer so it won't call malloc when debugging the allocator
-  setvbuf(stdout, NULL, _IONBF, 0);
-#endif // DEBUG
-
-  // Allocate the first chunk from the OS
-  header * block = allocate_chunk(ARENA_SIZE);
-
-  header * prevFencePost = get_header_from_offset(block, -ALLOC_HEADER_SIZE);
-  insert_os_chunk(prevFencePost);
-
-  lastFencePost = get_header_from_offset(block, get_size(block));
-
-  // Set the base pointer to the beginning of the first fencepost in the first
-  // chunk from the OS
-  base = ((char *) block) - ALLOC_HEADER_SIZE; //sizeof(header);
+static void stats_write_json(int fd, const allocator_stats * stats, bool lists) {
+  // Formatted on the stack so writing the stats does not allocate
+  char buf[512 + N_LISTS * 64];
+  size_t len = 0;
+  buf_puts(buf, &len, sizeof(buf), "{");
+  buf_put_field(buf, &len, sizeof(buf), "in_use_bytes", stats->inUseBytes);
+  if (lists) {
+    buf_put_field(buf, &len, sizeof(buf), "free_bytes", stats->freeBytes);
+  }
+  buf_put_field(buf, &len, sizeof(buf), "os_bytes", stats->osBytes);
+  buf_put_field(buf, &len, sizeof(buf), "peak_os_bytes", stats->peakOsBytes);
+  buf_put_field(buf, &len, sizeof(buf), "os_chunks", stats->osChunks);
+  buf_put_field(buf, &len, sizeof(buf), "mmapped_bytes", stats->mmappedBytes);
+  if (lists) {
+    buf_put_field(buf, &len, sizeof(buf), "largest_free", stats->largestFree);
+    // Four decimals, rounded
+    uint64_t fragmentation = (uint64_t) (stats->fragmentation * 10000 + 0.5);
+    buf_puts(buf, &len, sizeof(buf), "\"fragmentation\":");
+    buf_putu(buf, &len, sizeof(buf), fragmentation / 10000, 1);
+    buf_puts(buf, &len, sizeof(buf), ".");
+    buf_putu(buf, &len, sizeof(buf), fragmentation % 10000, 4);
+    buf_puts(buf, &len, sizeof(buf), ",");
+  }
+  buf_put_field(buf, &len, sizeof(buf), "lock_wait_ns", stats->lockWaitNanos);
+  buf_puts(buf, &len, sizeof(buf), "\"size_classes\":[");
 
-  // Initialize freelist sentinels
+  // Classes are named by the smallest block they hold, only used ones listed
+  bool first = true;
   for (int i = 0; i < N_LISTS; i++) {
-    header * freelist = &freelistSentinels[i];
-    freelist->next = freelist;
-    freelist->prev = freelist;
+    if (stats->mallocs[i] == 0 && stats->frees[i] == 0) {
+      continue;
+    }
+    buf_puts(buf, &len, sizeof(buf), first ? "{" : ",{");
+    buf_put_field(buf, &len, sizeof(buf), "block_size", sizeClassFirst[i] + ALLOC_HEADER_SIZE);
+    buf_put_field(buf, &len, sizeof(buf), "mallocs", stats->mallocs[i]);
+    buf_puts(buf, &len, sizeof(buf), "\"frees\":");
+    buf_putu(buf, &len, sizeof(buf), stats->frees[i], 1);
+    buf_puts(buf, &len, sizeof(buf), "}");
+    first = false;
   }
+  buf_puts(buf, &len, sizeof(buf), "]}\n");
 
-  // Insert first chunk into the free list
-  header * freelist = &freelistSentinels[N_LISTS - 1];
-  freelist->next = block;
-  freelist->prev = block;
-  block->next = freelist;
-  block->prev = freelist;
-}
-
-/* 
- * External interface
- */
-void * my_malloc(size_t size) {
-  pthread_mutex_lock(&mutex);
-  header * hdr = allocate_object(size); 
-  pthread_mutex_unlock(&mutex);
-  return hdr;
+  for (size_t off = 0; off < len; ) {
+    ssize_t n = write(fd, buf + off, len - off);
+    if (n <= 0) {
+      break;
+    }
+    off += n;
+  }
 }
 
-void * my_calloc(size_t nmemb, size_t size) {
-  return memset(my_malloc(size * nmemb), 0, size * nmemb);
+void my_malloc_stats_json(int fd) {
+  allocator_stats stats = my_malloc_stats();
+  stats_write_json(fd, &stats, true);
 }
 
-void * my_realloc(void * ptr, size_t size) {
-  void * mem = my_malloc(size);
-  memcpy(mem, ptr, size);
-  my_free(ptr);
-  return mem; 
+/**
+ * @brief Handler installed by my_malloc_stats_on_signal. Takes no lock, so
+ *        it leaves out the fields that need the free lists
+ *
+ * @param signum the signal (unused)
+ */
+static void stats_signal(int signum) {
+  (void) signum;
+  int saved = errno;
+  allocator_stats stats;
+  memset(&stats, 0, sizeof(stats));
+  stats_add_counters(&stats);
+  stats_write_json(__atomic_load_n(&statsSignalFd, __ATOMIC_RELAXED), &stats, false);
+  errno = saved;
 }
 
-void my_free(void * p) {
-  pthread_mutex_lock(&mutex);
-  deallocate_object(p);
-  pthread_mutex_unlock(&mutex);
+bool my_malloc_stats_on_signal(int signum, int fd) {
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = stats_signal;
+  action.sa_flags = SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  __atomic_store_n(&statsSignalFd, fd, __ATOMIC_RELAXED);
+  return sigaction(signum, &action, NULL) == 0;
 }
 
 bool verify() {
+#if SLAB_MAX_SIZE > 0
+  if (!verify_slabs()) {
+    return false;
+  }
+#endif
   return verify_freelist() && verify_tags();
 }
 
@@ -646,6 +4371,8 @@ static inline const char * allocated_to_string(char allocated) {
       return "true";
     case FENCEPOST:
       return "fencepost";
+    case MMAPPED:
+      return "mmapped";
   }
   assert(false);
 }
@@ -680,6 +4407,9 @@ static void print_color(header * block) {
     case FENCEPOST:
       printf("\033[0;33m");
       break;
+    case MMAPPED:
+      printf("\033[0;35m");
+      break;
   }
 }
 
@@ -690,14 +4420,32 @@ static void clear_color() {
 }
 
 static inline bool is_sentinel(void * p) {
-  for (int i = 0; i < N_LISTS; i++) {
-    if (&freelistSentinels[i] == p) {
-      return true;
+  for (int a = 0; a < N_ARENAS; a++) {
+    for (int i = 0; i < N_LISTS; i++) {
+      if (&arenas[a].freelistSentinels[i] == p) {
+        return true;
+      }
     }
   }
   return false;
 }
 
+/**
+ * @brief Helper to find the arena owning a free block or sentinel
+ *
+ * @param h the block or sentinel
+ *
+ * @return the arena whose free lists h is on
+ */
+static arena * freelist_arena(header * h) {
+  for (int a = 0; a < N_ARENAS; a++) {
+    if (h >= arenas[a].freelistSentinels && h < arenas[a].freelistSentinels + N_LISTS) {
+      return &arenas[a];
+    }
+  }
+  return arena_for_ptr(h);
+}
+
 /**
  * @brief Print the free list pointers if RELATIVE_POINTERS is set to true
  * then print the pointers as an offset from the base of the heap. This allows
@@ -731,15 +4479,19 @@ void print_object(header * block) {
   print_pointer(block);
   puts("");
   printf("\tsize: %zd\n", get_size(block) );
-  printf("\tleft_size: %zd\n", block->left_size);
+  if (COMPACT_HEADERS && !left_is_free(block)) {
+    printf("\tleft_size: unused\n");
+  } else {
+    printf("\tleft_size: %zd\n", block->left_size);
+  }
   printf("\tallocated: %s\n", allocated_to_string(get_state(block)));
   if (!get_state(block)) {
     printf("\tprev: ");
-    print_pointer(block->prev);
+    print_pointer(get_prev(freelist_arena(block), block));
     puts("");
 
     printf("\tnext: ");
-    print_pointer(block->next);
+    print_pointer(get_next(freelist_arena(block), block));
     puts("");
   }
   printf("]\n");
@@ -764,6 +4516,9 @@ void print_status(header * block) {
     case FENCEPOST:
       printf("[F]");
       break;
+    case MMAPPED:
+      printf("[M]");
+      break;
   }
   clear_color();
 }
@@ -772,7 +4527,7 @@ void print_status(header * block) {
 static void print_bitmap() {
   printf("bitmap: [");
   for(int i = 0; i < N_LISTS; i++) {
-    if ((freelist_bitmap[i >> 3] >> (i & 7)) & 1) {
+    if ((main_arena->freelistBitmap[i / 64] >> (i % 64)) & 1) {
       printf("\033[32m#\033[0m");
     } else {
       printf("\033[34m_\033[0m");
@@ -793,7 +4548,7 @@ static void print_bitmap() {
  * @param end Node to stop printing at
  */
 void print_sublist(printFormatter pf, header * start, header * end) {  
-  for (header * cur = start; cur != end; cur = cur->next) {
+  for (header * cur = start; cur != end; cur = get_next(freelist_arena(cur), cur)) {
     pf(cur); 
   }
 }
@@ -808,14 +4563,24 @@ void freelist_print(printFormatter pf) {
     return;
   }
 
-  for (size_t i = 0; i < N_LISTS; i++) {
-    header * freelist = &freelistSentinels[i];
-    if (freelist->next != freelist) {
-      printf("L%zu: ", i);
-      print_sublist(pf, freelist->next, freelist);
-      puts("");
+  for (int a = 0; a < N_ARENAS; a++) {
+    if (!arenas[a].initialized) {
+      continue;
+    }
+    if (N_ARENAS > 1) {
+      printf("ARENA %d\n", a);
+    }
+
+    for (size_t i = 0; i < N_LISTS; i++) {
+      header * freelist = &arenas[a].freelistSentinels[i];
+      header * first = get_next(&arenas[a], freelist);
+      if (first != freelist) {
+        printf("L%zu: ", i);
+        print_sublist(pf, first, freelist);
+        puts("");
+      }
+      fflush(stdout);
     }
-    fflush(stdout);
   }
 }
 
@@ -829,15 +4594,17 @@ void tags_print(printFormatter pf) {
     return;
   }
 
-  for (size_t i = 0; i < numOsChunks; i++) {
-    header * chunk = osChunkList[i];
-    pf(chunk);
-    for (chunk = get_right_header(chunk);
-         get_state(chunk) != FENCEPOST; 
-         chunk = get_right_header(chunk)) {
-        pf(chunk);
+  for (int a = 0; a < N_ARENAS; a++) {
+    for (size_t i = 0; i < arenas[a].numOsChunks; i++) {
+      header * chunk = arenas[a].osChunkList[i];
+      pf(chunk);
+      for (chunk = get_right_header(chunk);
+           get_state(chunk) != FENCEPOST; 
+           chunk = get_right_header(chunk)) {
+          pf(chunk);
+      }
+      pf(chunk);
+      fflush(stdout);
     }
-    pf(chunk);
-    fflush(stdout);
   }
 }
\ No newline at end of file
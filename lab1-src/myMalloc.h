@@ -2,10 +2,32 @@
 #define MY_MALLOC_H
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <sys/types.h>
 
 #define RELATIVE_POINTERS true
 
+#ifndef COMPACT_HEADERS
+// If not specified at compile time blocks use the full header layout below.
+// Otherwise free list links are 32 bit offsets and an allocated block's
+// data runs on into its right neighbour's left_size, which is only kept
+// while the block is free. That halves the per block overhead from 16 to 8
+// bytes, the minimum block only shrinks from 32 to 24 bytes. For the links
+// to fit, every chunk of an arena must lie within LINK_REACH, about 8.6 GB,
+// of its first chunk. Once the OS hands out memory beyond that the arena
+// cannot grow and allocations it cannot serve return NULL
+#define COMPACT_HEADERS 0
+#endif
+
+#ifndef MIN_ALIGNMENT
+// The alignment of every block the allocator returns, 8 or 16. With 16,
+// the x86-64 ABI's alignof(max_align_t), blocks are rounded to multiples of
+// 16 and every header starts on 16 so that SSE types work in any block.
+// The preload library needs that, as programs assume malloc's blocks are
+// aligned for any type
+#define MIN_ALIGNMENT 8
+#endif
+
 #ifndef ARENA_SIZE
 // If not specified at compile time use the default arena size
 #define ARENA_SIZE 4096
@@ -16,6 +38,189 @@
 #define N_LISTS 59
 #endif
 
+#ifndef SIZE_CLASS_EXACT_MAX
+// If not specified at compile time every list but the final one holds a
+// single size, 8 bytes apart. Otherwise only sizes up to this many bytes past
+// the header get a list each, and the remaining lists cover geometrically
+// growing ranges
+#define SIZE_CLASS_EXACT_MAX ((N_LISTS - 1) * 8)
+#endif
+
+#ifndef SIZE_CLASS_STEPS
+// Number of lists each doubling of size is split into past
+// SIZE_CLASS_EXACT_MAX
+#define SIZE_CLASS_STEPS 4
+#endif
+
+#ifndef FINAL_LIST_TREE
+// If not specified at compile time the final free list is searched first fit
+// in list order. Otherwise its blocks are also kept in a tree ordered by size
+// and address so the best fit is found in logarithmic time. Off by default as
+// best fit places blocks differently from the golden test outputs. The preload
+// library enables it, and the *_tree tests rerun the large tests with it
+#define FINAL_LIST_TREE 0
+#endif
+
+#ifndef PLACEMENT
+// The initial enum placement, first fit if not specified at compile time.
+// One policy is shared by the whole process: MYMALLOC_PLACEMENT, which takes
+// first, best, address or next, and my_malloc_set_placement change it for
+// every arena at once
+#define PLACEMENT 0
+#endif
+
+#ifndef GROW_FACTOR
+// Factor each arena's chunk size is multiplied by after every chunk from the
+// OS. The default of 1 always requests ARENA_SIZE chunks. Overridden at run
+// time by MYMALLOC_GROW_FACTOR, as are ARENA_SIZE by MYMALLOC_GROW_MIN and
+// the settings below by MYMALLOC_GROW_MAX and MYMALLOC_GROW_RESERVE
+#define GROW_FACTOR 1
+#endif
+
+#ifndef GROW_MAX
+// The largest chunk size geometric growth reaches
+#define GROW_MAX (32UL << 20)
+#endif
+
+#ifndef GROW_RESERVE
+// If not 0 the main arena commits its chunks from a region of this many bytes
+// reserved at startup instead of extending the heap with sbrk
+#define GROW_RESERVE 0
+#endif
+
+#ifndef HUGE_PAGES
+// If not specified at compile time arenas use normal pages. With 1 their
+// memory is aligned to HUGE_PAGE_SIZE and advised to use transparent huge
+// pages. With 2 secondary arenas' heaps and the main arena's reserved region
+// come from the huge page pool, falling back to transparent huge pages when
+// the pool cannot supply them. Overridden at run time by MYMALLOC_HUGE_PAGES
+#define HUGE_PAGES 0
+#endif
+
+#ifndef HUGE_PAGE_SIZE
+// Size of a huge page, the default on x86-64
+#define HUGE_PAGE_SIZE (2UL << 20)
+#endif
+
+#ifndef PREFAULT
+// If not specified at compile time memory is faulted in when first touched.
+// Otherwise chunks are populated as the arenas take them and blocks with
+// their own mapping are mapped with MAP_POPULATE. Overridden at run time by
+// MYMALLOC_PREFAULT
+#define PREFAULT 0
+#endif
+
+#ifndef N_ARENAS
+// If not specified at compile time all threads share a single arena
+#define N_ARENAS 1
+#endif
+
+#ifndef REMOTE_FREE
+// If not specified at compile time a thread freeing a block of another
+// thread's arena takes that arena's lock. Otherwise the block is pushed onto
+// the arena's lock-free remote free stack, which is drained the next time a
+// thread locks the arena to allocate or free, or my_malloc_trim runs
+#define REMOTE_FREE 0
+#endif
+
+#ifndef ARENA_HEAP_SIZE
+// Size and alignment of the heaps secondary arenas carve chunks from, must
+// be a power of two
+#define ARENA_HEAP_SIZE (64UL << 20)
+#endif
+
+#ifndef THREAD_CACHE_SIZE
+// If not specified at compile time per-thread caches are disabled. Otherwise
+// this is the maximum number of blocks each thread caches per free list
+#define THREAD_CACHE_SIZE 0
+#endif
+
+#ifndef THREAD_CACHE_BATCH
+// Number of blocks moved between a thread cache and the free lists at once
+#define THREAD_CACHE_BATCH ((THREAD_CACHE_SIZE + 1) / 2)
+#endif
+
+#ifndef SLAB_MAX_SIZE
+// If not specified at compile time the slab allocator is disabled. Otherwise
+// requests of up to this many bytes (a multiple of MIN_ALIGNMENT) are
+// served from slabs
+#define SLAB_MAX_SIZE 0
+#endif
+
+#ifndef SLAB_PAGE_SIZE
+// Size and alignment of each slab, must be a power of two
+#define SLAB_PAGE_SIZE 16384
+#endif
+
+#ifndef SLAB_REGION_SIZE
+// Address space reserved for slabs
+#define SLAB_REGION_SIZE (1UL << 30)
+#endif
+
+#ifndef TRIM_THRESHOLD
+// If not specified at compile time free memory is only returned to the OS by
+// my_malloc_trim. Otherwise freeing a block leaving a free block of at least
+// this many bytes returns its pages, trimming the heap to half of it when the
+// block is at the top. Overridden at run time by MYMALLOC_TRIM_THRESHOLD
+#define TRIM_THRESHOLD 0
+#endif
+
+#ifndef MMAP_THRESHOLD
+// If not specified at compile time requests are never served by mmap.
+// Otherwise requests of at least this many bytes get their own mapping.
+// Overridden at run time by the MYMALLOC_MMAP_THRESHOLD environment variable
+#define MMAP_THRESHOLD 0
+#endif
+
+#ifndef GUARD_SAMPLE_RATE
+// If not specified at compile time no blocks are guarded. Otherwise about one
+// in this many allocations of at most a page is placed at the end of a page
+// of its own followed by an inaccessible guard page, and the page is made
+// inaccessible once freed, so overflows and uses after free fault instead of
+// corrupting the heap. Overridden at run time by MYMALLOC_GUARD_SAMPLE_RATE
+#define GUARD_SAMPLE_RATE 0
+#endif
+
+#ifndef GUARD_SLOTS
+// Number of pages guarded blocks are placed on. Freed pages are reused oldest
+// first, and allocations are not guarded while every page is in use
+#define GUARD_SLOTS 64
+#endif
+
+#ifndef REGION_BLOCK_SIZE
+// Bytes regions take from the heap at a time. Requests over a quarter of it
+// get a block of their own
+#define REGION_BLOCK_SIZE 8192
+#endif
+
+#ifndef MAX_HANDLES
+// Number of handles that can exist at once. Address space for the handle
+// table is reserved on the first my_halloc and committed as it is used
+#define MAX_HANDLES (1 << 20)
+#endif
+
+#ifndef COMPACT_FRAGMENTATION
+// Percent of an arena's free bytes outside its largest free block at which
+// freeing handles compacts the arena. 0 leaves compaction to my_hcompact.
+// Overridden at run time by MYMALLOC_COMPACT_FRAGMENTATION
+#define COMPACT_FRAGMENTATION 50
+#endif
+
+#ifndef TRACE
+// If not specified at compile time allocation tracing is compiled out.
+// Otherwise setting MYMALLOC_TRACE to a path makes every process write a log
+// of its calls to the allocator to that path followed by its pid. The last
+// records are lost if the process ends without running its destructors
+#define TRACE 0
+#endif
+
+#ifndef STATS
+// If not specified at compile time the per size class counts of mallocs and
+// frees are compiled out and my_malloc_stats reports them as zero. The other
+// statistics are always kept
+#define STATS 0
+#endif
+
 /* Size of the header for an allocated block
  *
  * The size of the normal minus the size of the two free list pointers as
@@ -23,9 +228,21 @@
  */
 #define ALLOC_HEADER_SIZE (sizeof(header) - (2 * sizeof(header *)))
 
+#if COMPACT_HEADERS
+/* Size of the header of a free block, which is also the smallest block */
+#define FREE_HEADER_SIZE (ALLOC_HEADER_SIZE + 2 * sizeof(int32_t))
+
+/* Bytes of an allocated block not usable by the user */
+#define ALLOC_OVERHEAD (ALLOC_HEADER_SIZE - sizeof(size_t))
+#else
+#define FREE_HEADER_SIZE sizeof(header)
+#define ALLOC_OVERHEAD ALLOC_HEADER_SIZE
+#endif
+
 /* The minimum size request the allocator will service */
 #define MIN_ALLOCATION 8
 
+
 /**
  * @brief enum representing the allocation state of a block
  *
@@ -36,8 +253,34 @@ enum state {
   UNALLOCATED = 0,
   ALLOCATED = 1,
   FENCEPOST = 2,
+  MMAPPED = 3,
 };
 
+/*
+ * How the allocator picks among the free blocks that fit a request. The
+ * policy is a single process-wide setting, changed by my_malloc_set_placement
+ * or MYMALLOC_PLACEMENT, that every arena follows. Every policy splits a
+ * larger block the same way, handing out its high end
+ *
+ * PLACEMENT_FIRST_FIT The first block of the first list whose blocks all fit,
+ *                     the best fit in the final list with FINAL_LIST_TREE
+ * PLACEMENT_BEST_FIT The smallest block that fits
+ * PLACEMENT_ADDRESS_FIT The fitting block at the lowest address
+ * PLACEMENT_NEXT_FIT Like first fit, but the search resumes at the block the
+ *                    arena's last next fit allocation was split from. Each
+ *                    arena keeps its own rover, and it is used only when it
+ *                    lies in the list the request maps to; the search never
+ *                    carries on from it into other lists
+ */
+enum placement {
+  PLACEMENT_FIRST_FIT = 0,
+  PLACEMENT_BEST_FIT = 1,
+  PLACEMENT_ADDRESS_FIT = 2,
+  PLACEMENT_NEXT_FIT = 3,
+};
+
+#define PLACEMENT_POLICIES 4
+
 /*
  * The header contains all metadata about a block to be allocated
  * The size fields allow accessing the neighboring blocks in memory by
@@ -66,6 +309,32 @@ enum state {
  *
  * char[] data first byte of data pointed to by the list
  */
+#if COMPACT_HEADERS
+/*
+ * With COMPACT_HEADERS left_size comes first so it is the last word of the
+ * block to the left, holding that block's size only while it is free. The
+ * free list links are offsets in 8 byte units from the block to its
+ * neighbours in the list, the pointers are only used by the sentinels and
+ * to chain allocated blocks
+ */
+typedef struct header {
+  size_t left_size;
+  size_t size_state;
+  union {
+    // Used when the object is free
+    struct {
+      int32_t next_link;
+      int32_t prev_link;
+    };
+    struct {
+      struct header * next;
+      struct header * prev;
+    };
+    // Used when the object is allocated
+    char data[0];
+  };
+} header;
+#else
 typedef struct header {
   size_t size_state;
   size_t left_size;
@@ -79,18 +348,31 @@ typedef struct header {
     char data[0];
   };
 } header;
+#endif // COMPACT_HEADERS
 
 // Helper functions for getting and storing size and state from header
 // Since the size is a multiple of 8, the last 3 bits are always 0s.
 // Therefore we use the 3 lowest bits to store the state of the object.
 // This is going to save 8 bytes in all objects.
+// The two lowest bits hold the state, the third marks a block whose data past
+// the free list pointers is known to be zero. Changing the size clears it.
+// With COMPACT_HEADERS the top bit is set while the block to the left is
+// free, and a zeroed free block's last word may hold its size as well.
+
+#define ZEROED 0x4
+
+#if COMPACT_HEADERS
+#define LEFT_FREE (1UL << 63)
+#else
+#define LEFT_FREE 0UL
+#endif
 
 static inline size_t get_size(header * h) {
-	return h->size_state & ~0x3;
+	return h->size_state & ~(0x7 | LEFT_FREE);
 }
 
 static inline void set_size(header * h, size_t size) {
-	h->size_state = size | (h->size_state & 0x3);
+	h->size_state = size | (h->size_state & (0x3 | LEFT_FREE));
 }
 
 static inline enum  state get_state(header *h) {
@@ -105,7 +387,105 @@ static inline void set_size_and_state(header * h, size_t size, enum state s) {
 	h->size_state=(size & ~0x3)|(s &0x3);
 }
 
-#define MAX_OS_CHUNKS 1024
+static inline bool is_zeroed(header * h) {
+	return h->size_state & ZEROED;
+}
+
+static inline void set_zeroed(header * h, bool zeroed) {
+	h->size_state = (h->size_state & ~ZEROED) | (zeroed ? ZEROED : 0);
+}
+
+/*
+ * Allocator statistics summed over all arenas. With STATS blocks are counted
+ * per thread by the source that hands them out or takes them back, such as
+ * a thread cache, a slab or an arena, in the size class of a heap block of
+ * the same usable size. A realloc counts as a free and a malloc, and the
+ * blocks of regions and handles are counted too
+ *
+ * size_t mallocs[] Blocks handed out per free list size class
+ * size_t frees[] Blocks taken back per free list size class
+ * size_t inUseBytes Bytes in blocks handed out, including headers
+ * size_t freeBytes Bytes in free blocks
+ * size_t osBytes Bytes the arenas hold from the OS
+ * size_t peakOsBytes The sum of each arena's most osBytes at any time
+ * size_t osChunks Chunks requested from the OS
+ * size_t mmappedBytes Bytes in blocks with their own mapping
+ * size_t largestFree The size of the largest free block
+ * double fragmentation 1 - largestFree / freeBytes, 0 with no free memory
+ * uint64_t lockWaitNanos Time threads spent waiting for arena locks
+ */
+typedef struct allocator_stats {
+  size_t mallocs[N_LISTS];
+  size_t frees[N_LISTS];
+  size_t inUseBytes;
+  size_t freeBytes;
+  size_t osBytes;
+  size_t peakOsBytes;
+  size_t osChunks;
+  size_t mmappedBytes;
+  size_t largestFree;
+  double fragmentation;
+  uint64_t lockWaitNanos;
+} allocator_stats;
+
+/*
+ * Allocator calls recorded in a trace. A realloc is logged as two records so
+ * the replayer sees the old block released before another thread can be
+ * handed its address: TRACE_REALLOC before the call and TRACE_REALLOC_RESULT
+ * from the same thread once it returns
+ */
+enum trace_op {
+  TRACE_MALLOC = 0,
+  TRACE_CALLOC = 1,
+  TRACE_MEMALIGN = 2,
+  TRACE_FREE = 3,
+  TRACE_REALLOC = 4,
+  TRACE_REALLOC_RESULT = 5,
+};
+
+/*
+ * A trace file starts with TRACE_MAGIC ("MYMTRACE" read as a little endian
+ * word), the version and the record size, 8 bytes each, followed by the
+ * records in the order the calls were made
+ */
+#define TRACE_MAGIC 0x45434152544D594DULL
+#define TRACE_VERSION 1
+#define TRACE_HEADER_SIZE 24
+
+/*
+ * One call in a trace
+ *
+ * uint64_t ptr The block returned, freed or reallocated, 0 if malloc failed.
+ *              The address identifies the block until it is freed
+ * uint64_t size Bytes requested, nmemb * size for calloc
+ * uint64_t nanos Time since the process started tracing
+ * uint32_t thread Small number identifying the calling thread, from 1
+ * uint8_t op The call, an enum trace_op
+ * uint8_t alignLog2 log2 of the alignment requested from memalign
+ */
+typedef struct trace_record {
+  uint64_t ptr;
+  uint64_t size;
+  uint64_t nanos;
+  uint32_t thread;
+  uint8_t op;
+  uint8_t alignLog2;
+  uint16_t unused;
+} trace_record;
+
+/*
+ * A region hands out memory by bumping a pointer through blocks taken from
+ * the heap, and releases everything allocated from it at once. A region
+ * must not be used by two threads at the same time
+ */
+typedef struct my_region my_region;
+
+/*
+ * A handle names an object the allocator may move to compact the heap while
+ * it is unlocked. The address my_hlock returns stays valid until the
+ * matching my_hunlock
+ */
+typedef struct my_handle_entry * my_handle;
 
 // Malloc interface
 void * my_malloc(size_t size);
@@ -113,6 +493,69 @@ void * my_calloc(size_t nmemb, size_t size);
 void * my_realloc(void * ptr, size_t size);
 void my_free(void * p);
 
+// Free a block allocated with size bytes, like C23's free_sized. Debug
+// builds check that the block holds at least size bytes. Other builds ignore
+// the size, the lookups it could replace are still needed to find the
+// block's source and to catch double frees
+void my_free_sized(void * p, size_t size);
+
+// Aligned allocation, alignment must be a power of two
+void * my_memalign(size_t alignment, size_t size);
+void * my_aligned_alloc(size_t alignment, size_t size);
+int my_posix_memalign(void ** memptr, size_t alignment, size_t size);
+
+// Number of bytes usable in a block, at least the size requested
+size_t my_malloc_usable_size(void * p);
+
+// Whether p points into a page holding memory the allocator handed out
+bool my_malloc_owns(void * p);
+
+// Regions. Blocks from my_region_alloc are never passed to my_free, they are
+// released by resetting the region, which keeps its memory for reuse, or by
+// destroying it
+my_region * my_region_create();
+void * my_region_alloc(my_region * r, size_t size);
+void my_region_reset(my_region * r);
+void my_region_destroy(my_region * r);
+
+// Handles. my_hlock and my_hunlock calls on a handle nest, and its object
+// only moves while no lock is held. my_halloc returns NULL if the object or
+// a handle could not be allocated
+my_handle my_halloc(size_t size);
+void * my_hlock(my_handle h);
+void my_hunlock(my_handle h);
+void my_hfree(my_handle h);
+
+// Slide every unlocked handle's object towards the start of its chunk,
+// merging the free blocks between them. Returns the number of objects moved
+size_t my_hcompact();
+
+// Return every block in the calling thread's cache to the free lists
+void my_thread_cache_flush();
+
+// Return free memory to the OS, keeping pad bytes at the top of each heap.
+// Returns 1 if any memory was released
+int my_malloc_trim(size_t pad);
+
+// Choose how every arena places blocks from now on. Returns false for an
+// unknown policy
+bool my_malloc_set_placement(enum placement policy);
+
+// Collect allocator statistics
+allocator_stats my_malloc_stats();
+
+// Write the statistics to a file descriptor as a JSON object. Takes the
+// arena locks, so a signal handler may only call it if the signal cannot
+// interrupt the allocator
+void my_malloc_stats_json(int fd);
+
+// Write the statistics to fd as JSON whenever signum arrives. The handler
+// takes no locks, so it leaves out free_bytes, largest_free and fragmentation,
+// which need the free lists. Setting MYMALLOC_STATS_SIGNAL to a signal number
+// installs it at startup, writing to stderr. Returns false if the handler
+// could not be installed
+bool my_malloc_stats_on_signal(int signum, int fd);
+
 // Debug list verifitcation
 bool verify();
 
@@ -126,10 +569,6 @@ header * get_right_header(header * h);
  * will be present when the final binary is linked
  */
 extern void * base;
-extern header freelistSentinels[];
-extern char freelist_bitmap[];
-extern header * osChunkList[];
-extern size_t numOsChunks;
 
 /* Define printFormatter to be a function pointer type taking a sinle parameter
  * (a header pointer) and returning void
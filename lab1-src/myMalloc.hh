@@ -0,0 +1,166 @@
+#ifndef MY_MALLOC_HH
+#define MY_MALLOC_HH
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory_resource>
+#include <new>
+
+extern "C" {
+#include "myMalloc.h"
+}
+
+/*
+ * C++ adapters over my_malloc, so containers can opt into the allocator
+ * one at a time instead of replacing operator new or the C library's
+ * malloc for the whole program
+ *
+ * MyMallocResource and MyRegionResource are std::pmr::memory_resources for
+ * std::pmr containers. MyAllocator<T> is a stateless allocator for the
+ * containers whose allocator is a template parameter
+ */
+
+/**
+ * @brief Allocate a block with at least an alignment from my_malloc
+ *
+ * @param bytes number of bytes needed
+ * @param alignment a power of two
+ *
+ * @return the block, never NULL
+ *
+ * @throws std::bad_alloc if the allocator is out of memory
+ */
+inline void * my_malloc_aligned(std::size_t bytes, std::size_t alignment) {
+  // my_malloc returns NULL for 0 bytes, an allocator must return a block
+  if (bytes == 0) {
+    bytes = 1;
+  }
+  void * p = alignment <= MIN_ALIGNMENT ? my_malloc(bytes) : my_memalign(alignment, bytes);
+  if (p == nullptr) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+/*
+ * A memory resource allocating every block from my_malloc. All instances
+ * share the heap, so memory from one can be freed by any other
+ */
+class MyMallocResource : public std::pmr::memory_resource {
+ protected:
+  void * do_allocate(std::size_t bytes, std::size_t alignment) override {
+    return my_malloc_aligned(bytes, alignment);
+  }
+
+  void do_deallocate(void * p, std::size_t bytes, std::size_t) override {
+    my_free_sized(p, bytes);
+  }
+
+  bool do_is_equal(const std::pmr::memory_resource & other) const noexcept override {
+    return dynamic_cast<const MyMallocResource *>(&other) != nullptr;
+  }
+};
+
+/**
+ * @brief The MyMallocResource shared by the program, like
+ *        std::pmr::new_delete_resource
+ */
+inline std::pmr::memory_resource * my_malloc_resource() {
+  static MyMallocResource resource;
+  return &resource;
+}
+
+/*
+ * A memory resource bumping through a region of its own. Deallocation does
+ * nothing, release() frees everything allocated from the resource at once
+ * while keeping the region's blocks, and the destructor frees the region.
+ * Like the region, it must not be used by two threads at the same time
+ */
+class MyRegionResource : public std::pmr::memory_resource {
+ public:
+  MyRegionResource() : _region(my_region_create()) {
+    if (_region == nullptr) {
+      throw std::bad_alloc();
+    }
+  }
+
+  ~MyRegionResource() override {
+    my_region_destroy(_region);
+  }
+
+  MyRegionResource(const MyRegionResource &) = delete;
+  MyRegionResource & operator=(const MyRegionResource &) = delete;
+
+  // Free every block allocated from the resource
+  void release() {
+    my_region_reset(_region);
+  }
+
+ protected:
+  void * do_allocate(std::size_t bytes, std::size_t alignment) override {
+    // Regions align to MIN_ALIGNMENT, larger alignments are padded for
+    std::size_t padding = alignment > MIN_ALIGNMENT ? alignment - MIN_ALIGNMENT : 0;
+    if (bytes > std::numeric_limits<std::size_t>::max() - padding - 1) {
+      throw std::bad_alloc();
+    }
+    char * p = static_cast<char *>(my_region_alloc(_region, bytes + padding + (bytes == 0)));
+    if (p == nullptr) {
+      throw std::bad_alloc();
+    }
+    std::size_t misalignment = reinterpret_cast<std::uintptr_t>(p) & (alignment - 1);
+    return misalignment == 0 ? p : p + alignment - misalignment;
+  }
+
+  void do_deallocate(void *, std::size_t, std::size_t) override {
+  }
+
+  bool do_is_equal(const std::pmr::memory_resource & other) const noexcept override {
+    return this == &other;
+  }
+
+ private:
+  my_region * _region;
+};
+
+/*
+ * A stateless allocator over my_malloc for standard containers, e.g.
+ * std::vector<std::string *, MyAllocator<std::string *>>. Every instance
+ * compares equal, so containers using it can swap and move their blocks
+ * freely. deallocate passes the size on to my_free_sized, which checks it
+ * in debug builds only
+ */
+template <class T>
+class MyAllocator {
+ public:
+  using value_type = T;
+
+  MyAllocator() noexcept = default;
+
+  template <class U>
+  MyAllocator(const MyAllocator<U> &) noexcept {
+  }
+
+  T * allocate(std::size_t n) {
+    if (n > std::numeric_limits<std::size_t>::max() / sizeof(T)) {
+      throw std::bad_array_new_length();
+    }
+    return static_cast<T *>(my_malloc_aligned(n * sizeof(T), alignof(T)));
+  }
+
+  void deallocate(T * p, std::size_t n) noexcept {
+    my_free_sized(p, n * sizeof(T));
+  }
+};
+
+template <class T, class U>
+bool operator==(const MyAllocator<T> &, const MyAllocator<U> &) noexcept {
+  return true;
+}
+
+template <class T, class U>
+bool operator!=(const MyAllocator<T> &, const MyAllocator<U> &) noexcept {
+  return false;
+}
+
+#endif // MY_MALLOC_HH
@@ -0,0 +1,215 @@
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "myMalloc.h"
+
+/*
+ * Exports the standard allocation functions on top of the my_* interface so
+ * the allocator can be linked into a program or loaded with LD_PRELOAD in
+ * place of the C library's allocator
+ */
+
+/*
+ * Calls made while the calling thread is already inside the allocator, such
+ * as from stdio while a message is printed, are served from a static buffer
+ * instead of deadlocking on an arena lock. Blocks from it are never freed
+ */
+#define BOOTSTRAP_SIZE (64 * 1024)
+
+/* Space before each bootstrap block holding its size */
+#define BOOTSTRAP_HEADER 16
+
+static char bootstrapBuffer[BOOTSTRAP_SIZE] __attribute__ ((aligned (16)));
+static size_t bootstrapTop;
+
+static __thread int allocatorDepth __attribute__ ((tls_model ("initial-exec")));
+
+/**
+ * @brief Allocate from the bootstrap buffer
+ *
+ * @param size number of bytes the caller needs
+ *
+ * @return the block or NULL when the buffer is used up
+ */
+static void * bootstrap_alloc(size_t size) {
+  size_t need = (size + BOOTSTRAP_HEADER + 15) & ~(size_t) 15;
+  if (need < size) {
+    return NULL;
+  }
+  size_t off = __atomic_fetch_add(&bootstrapTop, need, __ATOMIC_RELAXED);
+  if (off + need > BOOTSTRAP_SIZE) {
+    return NULL;
+  }
+  *(size_t *) (bootstrapBuffer + off) = size;
+  return bootstrapBuffer + off + BOOTSTRAP_HEADER;
+}
+
+/**
+ * @brief Allocate an aligned block from the bootstrap buffer
+ *
+ * @param alignment a power of two the block's address must be a multiple of
+ * @param size number of bytes the caller needs
+ *
+ * @return the block or NULL when the buffer is used up
+ */
+static void * bootstrap_memalign(size_t alignment, size_t size) {
+  if (alignment <= BOOTSTRAP_HEADER) {
+    return bootstrap_alloc(size);
+  }
+  // Blocks start 16 aligned, so rounding up moves by a multiple of 16,
+  // leaving room for the size in front of the aligned block
+  if (size > SIZE_MAX - alignment) {
+    return NULL;
+  }
+  char * mem = bootstrap_alloc(size + alignment);
+  if (mem == NULL) {
+    return NULL;
+  }
+  char * aligned = (char *) (((uintptr_t) mem + alignment - 1) & ~(uintptr_t) (alignment - 1));
+  *(size_t *) (aligned - BOOTSTRAP_HEADER) = size;
+  return aligned;
+}
+
+static bool is_bootstrap(void * p) {
+  return (char *) p >= bootstrapBuffer && (char *) p < bootstrapBuffer + BOOTSTRAP_SIZE;
+}
+
+static size_t bootstrap_size(void * p) {
+  return *(size_t *) ((char *) p - BOOTSTRAP_HEADER);
+}
+
+/*
+ * my_malloc returns NULL for 0 bytes, which many programs take to mean they
+ * are out of memory, so like the C library hand out a minimal block instead
+ */
+static inline size_t nonzero(size_t size) {
+  return size == 0 ? 1 : size;
+}
+
+void * malloc(size_t size) {
+  if (allocatorDepth > 0) {
+    return bootstrap_alloc(size);
+  }
+  allocatorDepth++;
+  void * mem = my_malloc(nonzero(size));
+  allocatorDepth--;
+  if (mem == NULL) {
+    errno = ENOMEM;
+  }
+  return mem;
+}
+
+void free(void * p) {
+  // Memory freed from inside the allocator is leaked rather than risk
+  // taking a lock this thread holds
+  if (p == NULL || is_bootstrap(p) || allocatorDepth > 0) {
+    return;
+  }
+  allocatorDepth++;
+  my_free(p);
+  allocatorDepth--;
+}
+
+void * calloc(size_t nmemb, size_t size) {
+  if (allocatorDepth > 0) {
+    size_t total;
+    if (__builtin_mul_overflow(nmemb, size, &total)) {
+      return NULL;
+    }
+    // The static buffer starts zeroed and is never reused
+    return bootstrap_alloc(total);
+  }
+  allocatorDepth++;
+  void * mem = my_calloc(nonzero(nmemb), nonzero(size));
+  allocatorDepth--;
+  return mem;
+}
+
+void * realloc(void * p, size_t size) {
+  if (p == NULL) {
+    return malloc(size);
+  }
+  if (is_bootstrap(p)) {
+    void * mem = malloc(size);
+    if (mem != NULL) {
+      size_t old = bootstrap_size(p);
+      memcpy(mem, p, old < size ? old : size);
+    }
+    return mem;
+  }
+  if (allocatorDepth > 0) {
+    // Like free the old block is leaked, but its contents move to the
+    // bootstrap buffer
+    if (size == 0) {
+      return NULL;
+    }
+    void * mem = bootstrap_alloc(size);
+    if (mem != NULL) {
+      size_t old = my_malloc_usable_size(p);
+      memcpy(mem, p, old < size ? old : size);
+    }
+    return mem;
+  }
+  allocatorDepth++;
+  void * mem = my_realloc(p, size);
+  allocatorDepth--;
+  if (mem == NULL && size != 0) {
+    errno = ENOMEM;
+  }
+  return mem;
+}
+
+void * memalign(size_t alignment, size_t size) {
+  if (allocatorDepth > 0) {
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+      errno = EINVAL;
+      return NULL;
+    }
+    return bootstrap_memalign(alignment, size);
+  }
+  allocatorDepth++;
+  void * mem = my_memalign(alignment, nonzero(size));
+  allocatorDepth--;
+  return mem;
+}
+
+void * aligned_alloc(size_t alignment, size_t size) {
+  return memalign(alignment, size);
+}
+
+int posix_memalign(void ** memptr, size_t alignment, size_t size) {
+  if (allocatorDepth > 0) {
+    if (alignment == 0 || alignment % sizeof(void *) != 0 ||
+        (alignment & (alignment - 1)) != 0) {
+      return EINVAL;
+    }
+    void * mem = bootstrap_memalign(alignment, size);
+    if (mem == NULL) {
+      return ENOMEM;
+    }
+    *memptr = mem;
+    return 0;
+  }
+  allocatorDepth++;
+  int err = my_posix_memalign(memptr, alignment, nonzero(size));
+  allocatorDepth--;
+  return err;
+}
+
+void * valloc(size_t size) {
+  return memalign(getpagesize(), size);
+}
+
+void * pvalloc(size_t size) {
+  size_t page = getpagesize();
+  return memalign(page, (size + page - 1) & ~(page - 1));
+}
+
+size_t malloc_usable_size(void * p) {
+  if (p != NULL && is_bootstrap(p)) {
+    return bootstrap_size(p);
+  }
+  return my_malloc_usable_size(p);
+}
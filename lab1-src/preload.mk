@@ -0,0 +1,9 @@
+# Features libmymalloc.so is built with: 16 byte alignment, thread caches,
+# several arenas, slabs, mmap for large requests, geometric heap growth,
+# trimming, the final free list tree, remote frees and the per size class
+# call counts. Tracing is compiled in but only runs when MYMALLOC_TRACE is
+# set. Included by bench/Makefile so benchmarks linking my_malloc directly
+# measure the same allocator, and by tests/Makefile for test_preload
+PRELOAD_FEATURES = -DMIN_ALIGNMENT=16 -DN_ARENAS=8 -DTHREAD_CACHE_SIZE=32 -DSLAB_MAX_SIZE=256 \
+	-DMMAP_THRESHOLD=131072 -DGROW_FACTOR=2 -DTRIM_THRESHOLD=1048576 \
+	-DFINAL_LIST_TREE=1 -DTRACE=1 -DREMOTE_FREE=1 -DSTATS=1
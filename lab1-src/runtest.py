@@ -40,6 +40,32 @@ otherTests = [('test_locks', 3), \
               ];
 
 myTests = [('test_exact', 1),\
+            ('test_thread_cache', 1),\
+            ('test_arenas', 1),\
+            ('test_slab', 1),\
+            ('test_mmap', 1),\
+            ('test_grow', 1),\
+            ('test_realloc', 1),\
+            ('test_calloc', 1),\
+            ('test_memalign', 1),\
+            ('test_trim', 1),\
+            ('test_best_fit', 1),\
+            ('test_stats', 1),\
+            ('test_preload', 1),\
+            ('test_trace', 1),\
+            ('test_remote_free', 1),\
+            ('test_compact', 1),\
+            ('test_huge_pages', 1),\
+            ('test_guard', 1),\
+            ('test_chunk_map', 1),\
+            ('test_region', 1),\
+            ('test_size_classes', 1),\
+            ('test_placement', 1),\
+            ('test_handles', 1),\
+            ('test_allocator', 1),\
+            ('test_large_tree', 1),\
+            ('test_malloc_large_tree', 1),\
+            ('test_random_sizes_tree', 1),\
             # Add your additional tests here
             # They will be run when running `./runtest all`
             # and will not be counted in the total score
@@ -7,7 +7,7 @@ void ** mallocing_loop(void ** array, size_t size, size_t n, printFormatter pf,
 void * mallocing(size_t size, printFormatter pf, bool silent);
 void freeing_loop(void ** array, size_t size, size_t n, printFormatter pf, bool silent);
 void freeing(void * p, size_t size, printFormatter pf, bool silent);
-void initialize_test();
+void initialize_test(const char * name);
 void finalize_test();
 
 #endif // TESTING_H
@@ -0,0 +1,76 @@
+#include <cstdint>
+#include <cstdio>
+#include <list>
+#include <memory_resource>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include "testing.h"
+}
+#include "myMalloc.hh"
+
+struct alignas(64) Line {
+  char bytes[64];
+};
+
+int main() {
+  initialize_test(__FILE__);
+
+  // A command's arguments as the shell keeps them, in blocks from my_malloc
+  {
+    std::vector<std::string *, MyAllocator<std::string *>> arguments;
+    for (int i = 0; i < 100; i++) {
+      arguments.push_back(nullptr);
+    }
+    printf("vector owned: %s, capacity: %zu\n",
+           my_malloc_owns(arguments.data()) ? "yes" : "no", arguments.capacity());
+
+    std::list<int, MyAllocator<int>> numbers = { 1, 2, 3 };
+    printf("list nodes owned: %s\n", my_malloc_owns(&numbers.front()) ? "yes" : "no");
+
+    std::vector<Line, MyAllocator<Line>> lines(3);
+    printf("over-aligned elements aligned: %s\n",
+           reinterpret_cast<std::uintptr_t>(lines.data()) % 64 == 0 ? "yes" : "no");
+
+    try {
+      MyAllocator<int>().allocate(SIZE_MAX / 2);
+      printf("oversized request: allocated\n");
+    } catch (const std::bad_array_new_length &) {
+      printf("oversized request: bad_array_new_length\n");
+    }
+  }
+  printf("blocks after the containers are destroyed:\n");
+  tags_print(print_status);
+  puts("");
+
+  // std::pmr containers on the shared resource
+  {
+    std::pmr::vector<std::pmr::string> words(my_malloc_resource());
+    for (int i = 0; i < 10; i++) {
+      words.emplace_back(40, 'a' + i);
+    }
+    printf("pmr strings owned: %s, same resource: %s\n",
+           my_malloc_owns(words.back().data()) ? "yes" : "no",
+           *words.get_allocator().resource() == MyMallocResource() ? "yes" : "no");
+  }
+
+  // A region resource frees everything at once
+  {
+    MyRegionResource region;
+    std::pmr::vector<int> numbers(&region);
+    for (int i = 0; i < 1000; i++) {
+      numbers.push_back(i);
+    }
+    void * aligned = region.allocate(100, 256);
+    printf("region vector owned: %s, aligned block aligned: %s\n",
+           my_malloc_owns(numbers.data()) ? "yes" : "no",
+           reinterpret_cast<std::uintptr_t>(aligned) % 256 == 0 ? "yes" : "no");
+    printf("equal to another region: %s\n", region == MyRegionResource() ? "yes" : "no");
+    numbers = std::pmr::vector<int>(&region);
+    region.release();
+  }
+  printf("verify: %s\n", verify() ? "passed" : "failed");
+
+  finalize_test();
+}
@@ -0,0 +1,90 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "testing.h"
+
+#define NTHREADS 8
+#define NALLOCS 256
+#define ROUNDS 200
+
+static size_t allocated_blocks;
+
+static void count_allocated(header * block) {
+  if (get_state(block) == ALLOCATED) {
+    allocated_blocks++;
+  }
+}
+
+static size_t count_allocated_blocks() {
+  allocated_blocks = 0;
+  tags_print(count_allocated);
+  return allocated_blocks;
+}
+
+typedef struct result {
+  bool intact;
+  bool secondary;
+  char * leftover[NALLOCS];
+} result;
+
+static void * worker(void * arg) {
+  size_t id = (size_t) arg;
+  char * mainHeapEnd = sbrk(0);
+  result * res = my_malloc(sizeof(result));
+  res->intact = true;
+  res->secondary = false;
+
+  for (int round = 0; round < ROUNDS; round++) {
+    for (int i = 0; i < NALLOCS; i++) {
+      size_t size = 8 + (i * 37 + round) % 1000;
+      res->leftover[i] = my_malloc(size);
+      if ((char *) res->leftover[i] < (char *) base || (char *) res->leftover[i] >= mainHeapEnd) {
+        res->secondary = true;
+      }
+      memset(res->leftover[i], (char) (id + i), size);
+    }
+    // Free all but the last round, the main thread frees those
+    for (int i = 0; round < ROUNDS - 1 && i < NALLOCS; i++) {
+      size_t size = 8 + (i * 37 + round) % 1000;
+      for (size_t j = 0; j < size; j++) {
+        if (res->leftover[i][j] != (char) (id + i)) {
+          res->intact = false;
+        }
+      }
+      my_free(res->leftover[i]);
+    }
+  }
+  return res;
+}
+
+int main() {
+  initialize_test(__FILE__);
+
+  void * p = mallocing(8, print_status, false);
+
+  pthread_t threads[NTHREADS];
+  for (size_t i = 0; i < NTHREADS; i++) {
+    pthread_create(&threads[i], NULL, worker, (void *) i);
+  }
+  bool intact = true;
+  bool secondary = false;
+  for (size_t i = 0; i < NTHREADS; i++) {
+    result * res;
+    pthread_join(threads[i], (void **) &res);
+    intact = intact && res->intact;
+    secondary = secondary || res->secondary;
+    for (int j = 0; j < NALLOCS; j++) {
+      my_free(res->leftover[j]);
+    }
+    my_free(res);
+  }
+  printf("%d threads %s\n", NTHREADS, intact ? "kept their data intact" : "corrupted data");
+  printf("threads allocated from secondary arenas: %s\n", secondary ? "yes" : "no");
+
+  freeing(p, 8, print_status, true);
+  printf("allocated blocks after freeing in the main thread: %zu\n", count_allocated_blocks());
+
+  verify();
+}
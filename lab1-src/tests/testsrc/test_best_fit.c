@@ -0,0 +1,39 @@
+#include <stdio.h>
+
+#include "testing.h"
+
+int main() {
+  initialize_test(__FILE__);
+
+  // Three large blocks kept apart by small allocated ones
+  void * a = mallocing(2000, print_status, true);
+  void * s1 = mallocing(8, print_status, true);
+  void * b = mallocing(600, print_status, true);
+  void * s2 = mallocing(8, print_status, true);
+  void * c = mallocing(1200, print_status, true);
+  void * s3 = mallocing(8, print_status, false);
+
+  // Freed so the final list is b, a, c: first fit in list order would take
+  // a, the best fit is c
+  freeing(c, 1200, print_status, true);
+  freeing(a, 2000, print_status, true);
+  freeing(b, 600, print_status, false);
+  freelist_print(basic_print);
+  puts("\n");
+
+  void * d = mallocing(1100, print_status, false);
+  freelist_print(basic_print);
+  puts("\n");
+
+  // a is now the smallest block that fits, ahead of the larger remainder of
+  // the first chunk
+  void * e = mallocing(864, print_status, false);
+
+  freeing(d, 1100, print_status, true);
+  freeing(e, 864, print_status, true);
+  freeing(s1, 8, print_status, true);
+  freeing(s2, 8, print_status, true);
+  freeing(s3, 8, print_status, true);
+
+  finalize_test();
+}
@@ -0,0 +1,59 @@
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "testing.h"
+
+static bool zeroed(char * p, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    if (p[i] != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static char * callocing(size_t nmemb, size_t size) {
+  printf("callocing %zu x %zu bytes\n", nmemb, size);
+  char * p = my_calloc(nmemb, size);
+  printf("zeroed: %s\n", zeroed(p, nmemb * size) ? "yes" : "no");
+  tags_print(print_status);
+  puts("\n");
+  verify();
+  return p;
+}
+
+int main() {
+  initialize_test(__FILE__);
+
+  // A count and size whose product overflows fail instead of wrapping
+  errno = 0;
+  void * o = my_calloc(SIZE_MAX / 2, 4);
+  printf("overflowing calloc returned %s, errno %s\n",
+         o == NULL ? "NULL" : "a block", errno == ENOMEM ? "ENOMEM" : "unset");
+
+  // A block spanning the fenceposts between the first two chunks, then one
+  // from a chunk joined to an allocated block
+  char * p = callocing(1, 5000);
+  char * q = callocing(9, 500);
+
+  // Blocks that held data are cleared
+  memset(p, 'p', 5000);
+  memset(q, 'q', 4500);
+  my_free(q);
+  q = callocing(10, 450);
+
+  // Small requests are cleared as well
+  char * r = mallocing(64, print_status, true);
+  memset(r, 'r', 64);
+  my_free(r);
+  r = callocing(8, 8);
+
+  memset(p, 0, 5000);
+  freeing(p, 5000, print_status, false);
+  freeing(q, 4500, print_status, false);
+  freeing(r, 64, print_status, false);
+
+  finalize_test();
+}
@@ -0,0 +1,62 @@
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "testing.h"
+
+#define CHUNKS 1500
+#define BLOCK_SIZE (ARENA_SIZE - 3 * ALLOC_HEADER_SIZE - 48)
+
+static int global;
+
+int main() {
+  initialize_test(__FILE__);
+
+  // Moving the break between allocations makes every chunk a separate one,
+  // more than the old limit on recorded chunks
+  void * blocks[CHUNKS];
+  for (int i = 0; i < CHUNKS; i++) {
+    blocks[i] = my_malloc(BLOCK_SIZE);
+    sbrk(16);
+  }
+  printf("verify with %d chunks: %s\n", CHUNKS, verify() ? "passed" : "failed");
+
+  // A broken fencepost in the last chunk is still found
+  header * fencepost = (header *) ((char *) blocks[CHUNKS - 1] - ALLOC_HEADER_SIZE);
+  while ((fencepost->size_state & 0x3) != FENCEPOST) {
+    fencepost = (header *) ((char *) fencepost - fencepost->left_size);
+  }
+  fencepost->size_state ^= 0x3;
+  fflush(stdout);
+  printf("verify with the last chunk corrupted: %s\n", verify() ? "passed" : "failed");
+  fencepost->size_state ^= 0x3;
+
+  int local;
+  void * large = my_malloc(1 << 20);
+  printf("owns heap block: %s\n", my_malloc_owns(blocks[0]) ? "yes" : "no");
+  printf("owns mmapped block: %s\n", my_malloc_owns(large) ? "yes" : "no");
+  printf("owns stack variable: %s\n", my_malloc_owns(&local) ? "yes" : "no");
+  printf("owns global variable: %s\n", my_malloc_owns(&global) ? "yes" : "no");
+  my_free(large);
+  printf("owns freed mmapped block: %s\n", my_malloc_owns(large) ? "yes" : "no");
+
+  // Freeing memory the allocator does not own aborts
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid == 0) {
+    setvbuf(stdout, NULL, _IONBF, 0);
+    my_free(&local);
+    exit(0);
+  }
+  int status;
+  waitpid(pid, &status, 0);
+  printf("child freeing a stack variable killed by %s\n",
+         WIFSIGNALED(status) && WTERMSIG(status) == SIGABRT ? "SIGABRT" : "something else");
+
+  for (int i = 0; i < CHUNKS; i++) {
+    my_free(blocks[i]);
+  }
+  printf("verify: %s\n", verify() ? "passed" : "failed");
+}
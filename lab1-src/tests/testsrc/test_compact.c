@@ -0,0 +1,38 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "testing.h"
+
+int main() {
+  initialize_test(__FILE__);
+
+  // The smallest block is 24 bytes and 8 of them are overhead
+  void * a = mallocing(8, print_status, true);
+  void * b = mallocing(16, print_status, true);
+  void * c = mallocing(8, print_status, true);
+  void * d = mallocing(100, print_status, false);
+  printf("usable sizes: %zu %zu %zu %zu\n", my_malloc_usable_size(a),
+         my_malloc_usable_size(b), my_malloc_usable_size(c), my_malloc_usable_size(d));
+
+  // A block's last word is the left_size of its right neighbour, which is
+  // only written once the block is free
+  memset(b, 0xAB, my_malloc_usable_size(b));
+  freeing(a, 8, print_object, false);
+  freeing(c, 8, print_object, false);
+  bool intact = true;
+  for (size_t i = 0; i < my_malloc_usable_size(b); i++) {
+    intact &= ((unsigned char *) b)[i] == 0xAB;
+  }
+  printf("data intact after freeing neighbours: %s\n", intact ? "yes" : "no");
+
+  // Both free blocks are on the first list, linked by their offsets
+  freelist_print(print_object);
+  puts("");
+
+  memset(b, 0, my_malloc_usable_size(b));
+  freeing(b, 16, print_object, false);
+  freeing(d, 100, print_status, false);
+  printf("verify: %s\n", verify() ? "passed" : "failed");
+
+  finalize_test();
+}
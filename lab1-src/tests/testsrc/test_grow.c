@@ -0,0 +1,49 @@
+#include <stdio.h>
+#include <unistd.h>
+
+#include "testing.h"
+
+#define NALLOCS 1000
+
+static size_t heap_size;
+
+static void sum_sizes(header * block) {
+  heap_size += get_size(block);
+}
+
+static size_t get_heap_size() {
+  heap_size = 0;
+  tags_print(sum_sizes);
+  return heap_size;
+}
+
+int main() {
+  initialize_test(__FILE__);
+
+  void * brk = sbrk(0);
+  void * ptrs[NALLOCS];
+  size_t last_size = get_heap_size();
+  printf("heap size: %zu\n", last_size);
+  for (int i = 0; i < NALLOCS; i++) {
+    ptrs[i] = my_malloc(1000);
+    if (get_heap_size() != last_size) {
+      last_size = get_heap_size();
+      printf("heap size: %zu\n", last_size);
+    }
+  }
+
+  // A request larger than the next chunk gets a chunk sized to fit it
+  void * large = my_malloc(4 * GROW_MAX);
+  printf("heap size after a large request: %zu\n", get_heap_size());
+
+  printf("heap grew with sbrk: %s\n", sbrk(0) != brk ? "yes" : "no");
+
+  my_free(large);
+  for (int i = 0; i < NALLOCS; i++) {
+    my_free(ptrs[i]);
+  }
+
+  verify();
+  printf("free lists after freeing everything:\n");
+  freelist_print(print_list);
+}
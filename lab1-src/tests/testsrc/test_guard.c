@@ -0,0 +1,111 @@
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "testing.h"
+
+// Check a block ends within slack bytes of a page end
+static bool at_page_end(void * p, size_t size, size_t slack) {
+  size_t page = getpagesize();
+  uintptr_t end = (uintptr_t) p + size;
+  return end % page == 0 || page - end % page < slack;
+}
+
+static void overflow() {
+  char * p = my_malloc(96);
+  p[96] = 1;
+}
+
+static void use_after_free() {
+  char * p = my_malloc(96);
+  my_free(p);
+  printf("read %d\n", p[0]);
+}
+
+static void double_free() {
+  char * p = my_malloc(96);
+  my_free(p);
+  my_free(p);
+}
+
+// Run a faulting function in a child with its reports on stdout
+static void run_child(const char * name, void (* fn)()) {
+  printf("%s:\n", name);
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid == 0) {
+    setvbuf(stdout, NULL, _IONBF, 0);
+    dup2(STDOUT_FILENO, STDERR_FILENO);
+    fn();
+    exit(0);
+  }
+  int status;
+  waitpid(pid, &status, 0);
+  if (WIFSIGNALED(status)) {
+    printf("child killed by %s\n", WTERMSIG(status) == SIGSEGV ? "SIGSEGV" :
+           WTERMSIG(status) == SIGABRT ? "SIGABRT" : "another signal");
+  } else {
+    printf("child exited with %d\n", WEXITSTATUS(status));
+  }
+}
+
+int main() {
+  initialize_test(__FILE__);
+
+  // A thread's first allocation only starts its countdown, every later one
+  // is guarded
+  my_free(my_malloc(8));
+
+  char * p = my_malloc(96);
+  printf("block ends at a page end: %s\n", at_page_end(p, 96, 1) ? "yes" : "no");
+  printf("usable size: %zu\n", my_malloc_usable_size(p));
+  memset(p, 0xAB, 96);
+
+  // Growing moves the block to a new slot
+  char * q = my_realloc(p, 200);
+  bool intact = true;
+  for (int i = 0; i < 96; i++) {
+    intact &= (unsigned char) q[i] == 0xAB;
+  }
+  printf("realloc moved: %s, data intact: %s, ends at a page end: %s\n",
+         q != p ? "yes" : "no", intact ? "yes" : "no", at_page_end(q, 200, 1) ? "yes" : "no");
+  my_free(q);
+
+  char * a = my_memalign(256, 100);
+  printf("memalign aligned: %s, ends near a page end: %s\n",
+         (uintptr_t) a % 256 == 0 ? "yes" : "no", at_page_end(a, 100, 256) ? "yes" : "no");
+  my_free(a);
+
+  // Fill every slot, then the next allocation falls back to the heap
+  char * blocks[GUARD_SLOTS];
+  for (int i = 0; i < GUARD_SLOTS; i++) {
+    blocks[i] = my_malloc(2000);
+    memset(blocks[i], 0xFF, 2000);
+  }
+  char * heap = my_malloc(2000);
+  printf("block with every slot in use from the heap: %s\n",
+         at_page_end(heap, 2000, 1) ? "no" : "yes");
+  my_free(heap);
+  for (int i = 0; i < GUARD_SLOTS; i++) {
+    my_free(blocks[i]);
+  }
+
+  // Reused slots were zeroed when freed
+  char * z = my_calloc(1, 2000);
+  bool zeroed = true;
+  for (int i = 0; i < 2000; i++) {
+    zeroed &= z[i] == 0;
+  }
+  printf("calloc zeroed: %s\n", zeroed ? "yes" : "no");
+  my_free(z);
+
+  run_child("overflow", overflow);
+  run_child("use after free", use_after_free);
+  run_child("double free", double_free);
+
+  printf("verify: %s\n", verify() ? "passed" : "failed");
+}
@@ -0,0 +1,94 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "testing.h"
+
+#define HANDLES 8
+#define MANY 130
+
+// Check every byte of a handle's object still holds its value
+static bool intact(my_handle h, size_t size, int value) {
+  unsigned char * p = my_hlock(h);
+  bool same = true;
+  for (size_t i = 0; i < size; i++) {
+    same &= p[i] == value;
+  }
+  my_hunlock(h);
+  return same;
+}
+
+int main() {
+  initialize_test(__FILE__);
+
+  // Handles' objects with a block from my_malloc among them
+  my_handle h[HANDLES];
+  void * fixed = NULL;
+  for (int i = 0; i < HANDLES; i++) {
+    h[i] = my_halloc(200);
+    memset(my_hlock(h[i]), i, 200);
+    my_hunlock(h[i]);
+    if (i == 2) {
+      fixed = my_malloc(200);
+    }
+  }
+
+  // Free some and keep one locked
+  my_hfree(h[1]);
+  my_hfree(h[3]);
+  my_hfree(h[5]);
+  void * locked = my_hlock(h[4]);
+  printf("before compacting:\n");
+  tags_print(print_status);
+  puts("");
+
+  // Unlocked objects slide left past the holes, the locked one and the block
+  // from my_malloc stay where they are
+  printf("objects moved: %zu\n", my_hcompact());
+  tags_print(print_status);
+  puts("");
+  printf("locked object in place: %s\n", my_hlock(h[4]) == locked ? "yes" : "no");
+  my_hunlock(h[4]);
+  my_hunlock(h[4]);
+  bool same = true;
+  for (int i = 0; i < HANDLES; i += 2) {
+    same &= intact(h[i], 200, i);
+  }
+  same &= intact(h[7], 200, 7);
+  printf("data intact: %s\n", same ? "yes" : "no");
+  printf("verify: %s\n", verify() ? "passed" : "failed");
+
+  // Freeing every other handle fragments the heap until a free compacts it
+  my_handle many[MANY];
+  void * before[MANY];
+  for (int i = 0; i < MANY; i++) {
+    many[i] = my_halloc(64);
+    before[i] = my_hlock(many[i]);
+    memset(before[i], i, 64);
+    my_hunlock(many[i]);
+  }
+  for (int i = 0; i < MANY; i += 2) {
+    my_hfree(many[i]);
+  }
+  bool moved = false;
+  same = true;
+  for (int i = 1; i < MANY; i += 2) {
+    moved |= my_hlock(many[i]) != before[i];
+    my_hunlock(many[i]);
+    same &= intact(many[i], 64, i);
+  }
+  printf("moved by freeing: %s, data intact: %s\n", moved ? "yes" : "no", same ? "yes" : "no");
+  printf("verify: %s\n", verify() ? "passed" : "failed");
+
+  for (int i = 1; i < MANY; i += 2) {
+    my_hfree(many[i]);
+  }
+  for (int i = 0; i < HANDLES; i++) {
+    if (i != 1 && i != 3 && i != 5) {
+      my_hfree(h[i]);
+    }
+  }
+  my_free(fixed);
+  printf("verify: %s\n", verify() ? "passed" : "failed");
+
+  finalize_test();
+}
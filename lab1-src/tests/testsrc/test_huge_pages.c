@@ -0,0 +1,62 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "testing.h"
+
+#define LARGE_SIZE (4 << 20)
+
+// Check every page of a range is resident
+static bool resident(void * mem, size_t size) {
+  size_t page = getpagesize();
+  char * start = (char *) ((uintptr_t) mem & ~(uintptr_t) (page - 1));
+  size_t pages = ((char *) mem + size - start + page - 1) / page;
+  unsigned char vec[pages];
+  if (mincore(start, pages * page, vec) != 0) {
+    return false;
+  }
+  for (size_t i = 0; i < pages; i++) {
+    if (!(vec[i] & 1)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static void * worker(void * arg) {
+  char * p = my_malloc(1000);
+  memset(p, 1, 1000);
+  *(bool *) arg = p[999] == 1;
+  my_free(p);
+  return NULL;
+}
+
+int main() {
+  initialize_test(__FILE__);
+
+  // Without huge pages in the pool the main arena's reserved region falls
+  // back to transparent huge pages, still aligned to a huge page
+  printf("heap aligned to a huge page: %s\n",
+         (uintptr_t) base % HUGE_PAGE_SIZE == 0 ? "yes" : "no");
+  printf("first chunk prefaulted: %s\n", resident(base, ARENA_SIZE) ? "yes" : "no");
+
+  void * p = mallocing(100, print_status, false);
+  freeing(p, 100, print_status, false);
+
+  // A secondary arena's heap falls back the same way
+  bool used = false;
+  pthread_t thread;
+  pthread_create(&thread, NULL, worker, &used);
+  pthread_join(thread, NULL);
+  printf("secondary arena usable: %s\n", used ? "yes" : "no");
+
+  // Blocks with their own mapping are mapped with MAP_POPULATE
+  void * large = my_malloc(LARGE_SIZE);
+  printf("large block prefaulted: %s\n", resident(large, LARGE_SIZE) ? "yes" : "no");
+  my_free(large);
+
+  printf("verify: %s\n", verify() ? "passed" : "failed");
+}
@@ -0,0 +1,55 @@
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "testing.h"
+
+static void * aligning(size_t alignment, size_t size) {
+  printf("aligning %zu bytes to %zu\n", size, alignment);
+  void * p = my_memalign(alignment, size);
+  printf("aligned: %s\n", (uintptr_t) p % alignment == 0 ? "yes" : "no");
+  tags_print(print_status);
+  puts("\n");
+  verify();
+  memset(p, 0, size);
+  return p;
+}
+
+int main() {
+  initialize_test(__FILE__);
+
+  // The slack on both sides of the aligned block goes back to the free lists
+  void * p = aligning(64, 100);
+  void * q = aligning(256, 8);
+  void * r = aligning(1024, 2000);
+
+  // Requests above the mmap threshold get an aligned mapping
+  void * s = aligning(8192, 70000);
+
+  void * t;
+  int err = my_posix_memalign(&t, 32, 48);
+  printf("posix_memalign(32) returned %d, aligned: %s\n", err,
+         (uintptr_t) t % 32 == 0 ? "yes" : "no");
+  memset(t, 0, 48);
+  void * u = my_aligned_alloc(128, 128);
+  printf("aligned_alloc(128) aligned: %s\n", (uintptr_t) u % 128 == 0 ? "yes" : "no");
+  memset(u, 0, 128);
+
+  // Alignments that are not powers of two are rejected
+  errno = 0;
+  void * v = my_memalign(48, 64);
+  printf("memalign(48) returned %s, errno %s\n", v == NULL ? "NULL" : "a block",
+         errno == EINVAL ? "EINVAL" : "unset");
+  printf("posix_memalign(4) returned %s\n",
+         my_posix_memalign(&v, 4, 64) == EINVAL ? "EINVAL" : "success");
+
+  freeing(p, 100, print_status, false);
+  freeing(q, 8, print_status, false);
+  freeing(r, 2000, print_status, false);
+  freeing(s, 70000, print_status, true);
+  freeing(t, 48, print_status, false);
+  freeing(u, 128, print_status, false);
+
+  finalize_test();
+}
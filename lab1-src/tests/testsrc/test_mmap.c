@@ -0,0 +1,36 @@
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "testing.h"
+
+#define LARGE (4 * 1024 * 1024)
+
+static bool is_mapped(void * p) {
+  unsigned char vec;
+  void * page = (void *) ((size_t) p & ~(size_t) (getpagesize() - 1));
+  return mincore(page, getpagesize(), &vec) == 0 || errno != ENOMEM;
+}
+
+int main() {
+  initialize_test(__FILE__);
+
+  // Requests below the threshold come from the heap
+  void * small = mallocing(MMAP_THRESHOLD - 1, print_status, false);
+
+  // Requests at the threshold get their own mapping and leave the heap alone
+  char * large = mallocing(LARGE, print_status, false);
+  header * hdr = (header *) (large - ALLOC_HEADER_SIZE);
+  printf("large block state: %s\n", get_state(hdr) == MMAPPED ? "mmapped" : "heap");
+  printf("large block rounded to pages: %s\n",
+         get_size(hdr) % getpagesize() == 0 && get_size(hdr) >= LARGE ? "yes" : "no");
+
+  freeing(large, LARGE, print_status, true);
+  printf("large block mapped after free: %s\n", is_mapped(large) ? "yes" : "no");
+
+  freeing(small, MMAP_THRESHOLD - 1, print_status, false);
+
+  finalize_test();
+}
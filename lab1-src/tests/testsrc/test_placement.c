@@ -0,0 +1,64 @@
+#include <stdio.h>
+
+#include "testing.h"
+
+static char * a;
+static char * b;
+static char * c;
+
+// Name the free block an allocation was split from
+static const char * block_of(char * p) {
+  if (p >= a && p < a + 2000) {
+    return "a";
+  } else if (p >= b && p < b + 600) {
+    return "b";
+  } else if (p >= c && p < c + 1200) {
+    return "c";
+  }
+  return "the start of the chunk";
+}
+
+int main() {
+  initialize_test(__FILE__);
+
+  // Three large blocks kept apart by small allocated ones, below them the
+  // rest of the chunk
+  a = mallocing(2000, print_status, true);
+  void * s1 = mallocing(8, print_status, true);
+  b = mallocing(600, print_status, true);
+  void * s2 = mallocing(8, print_status, true);
+  c = mallocing(1200, print_status, true);
+  void * s3 = mallocing(8, print_status, false);
+
+  // Freed so the final list is b, a, c and then the start of the chunk
+  freeing(c, 1200, print_status, true);
+  freeing(a, 2000, print_status, true);
+  freeing(b, 600, print_status, false);
+  freelist_print(basic_print);
+  puts("\n");
+
+  // Next fit runs while the list is in that order, so it differs from first
+  // fit by carrying on from a rather than returning to b
+  enum placement policies[] = { PLACEMENT_FIRST_FIT, PLACEMENT_NEXT_FIT,
+                                PLACEMENT_BEST_FIT, PLACEMENT_ADDRESS_FIT };
+  const char * names[] = { "first fit", "next fit", "best fit", "address fit" };
+  for (int i = 0; i < PLACEMENT_POLICIES; i++) {
+    my_malloc_set_placement(policies[i]);
+    char * x = my_malloc(700);
+    char * y = my_malloc(100);
+    printf("%s: 700 bytes from %s, then 100 bytes from %s\n", names[i],
+           block_of(x), block_of(y));
+    my_free(y);
+    my_free(x);
+  }
+  printf("unknown policy accepted: %s\n",
+         my_malloc_set_placement(PLACEMENT_POLICIES) ? "yes" : "no");
+  puts("");
+
+  freeing(s1, 8, print_status, true);
+  freeing(s2, 8, print_status, true);
+  freeing(s3, 8, print_status, false);
+  printf("verify: %s\n", verify() ? "passed" : "failed");
+
+  finalize_test();
+}
@@ -0,0 +1,130 @@
+#include <errno.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <xmmintrin.h>
+
+#include "testing.h"
+
+#define N_THREADS 4
+#define N_BLOCKS 1000
+#define MAX_ALIGNED_SIZE 4096
+
+static void * sized[MAX_ALIGNED_SIZE + 1];
+
+static void * churn(void * arg) {
+  char ** blocks = calloc(N_BLOCKS, sizeof(char *));
+  for (int round = 0; round < 20; round++) {
+    for (int i = 0; i < N_BLOCKS; i++) {
+      blocks[i] = realloc(blocks[i], 8 + (i * 37 + round) % 2000);
+      memset(blocks[i], round, 8);
+    }
+  }
+  for (int i = 0; i < N_BLOCKS; i++) {
+    free(blocks[i]);
+  }
+  free(blocks);
+  return arg;
+}
+
+int main() {
+  initialize_test(__FILE__);
+
+  // The C library's entry points are served by the allocator
+  size_t before = my_malloc_stats().inUseBytes;
+  char * s = malloc(1000);
+  printf("malloc counted by my_malloc_stats: %s\n",
+         my_malloc_stats().inUseBytes > before ? "yes" : "no");
+  printf("malloc_usable_size at least 1000: %s\n", malloc_usable_size(s) >= 1000 ? "yes" : "no");
+  char * d = strdup("duplicated by strdup");
+  printf("%s\n", d);
+  free(d);
+
+  char * z = calloc(10, 1000);
+  bool zeroed = true;
+  for (int i = 0; i < 10000; i++) {
+    zeroed &= z[i] == 0;
+  }
+  printf("calloc zeroed: %s\n", zeroed ? "yes" : "no");
+
+  void * m = memalign(64, 100);
+  void * p;
+  int err = posix_memalign(&p, 256, 100);
+  void * a = aligned_alloc(4096, 4096);
+  printf("memalign, posix_memalign and aligned_alloc aligned: %s\n",
+         (uintptr_t) m % 64 == 0 && err == 0 && (uintptr_t) p % 256 == 0
+         && (uintptr_t) a % 4096 == 0 ? "yes" : "no");
+
+  // Every block is aligned for any type as the x86-64 ABI requires, from
+  // slabs, free lists, the thread cache once blocks are freed and mmap
+  bool aligned16 = true;
+  for (size_t size = 1; size <= MAX_ALIGNED_SIZE; size++) {
+    sized[size] = malloc(size);
+    aligned16 &= (uintptr_t) sized[size] % 16 == 0;
+  }
+  for (size_t size = 1; size <= MAX_ALIGNED_SIZE; size += 2) {
+    free(sized[size]);
+  }
+  for (size_t size = 1; size <= MAX_ALIGNED_SIZE; size += 2) {
+    sized[size] = malloc(size);
+    aligned16 &= (uintptr_t) sized[size] % 16 == 0;
+  }
+  void * big = malloc(1 << 20);
+  aligned16 &= (uintptr_t) big % 16 == 0;
+  printf("blocks of 1 to %d bytes and mmapped blocks 16 byte aligned: %s\n",
+         MAX_ALIGNED_SIZE, aligned16 ? "yes" : "no");
+  for (size_t size = 1; size <= MAX_ALIGNED_SIZE; size++) {
+    free(sized[size]);
+  }
+  free(big);
+
+  // An unaligned block would fault on the aligned SSE loads
+  float sum[4];
+  __m128 total = _mm_setzero_ps();
+  for (size_t n = 1; n <= 64; n++) {
+    __m128 * v = calloc(n, sizeof(__m128));
+    v[n - 1] = _mm_set1_ps(n);
+    total = _mm_add_ps(total, _mm_load_ps((float *) &v[n - 1]));
+    free(v);
+  }
+  _mm_storeu_ps(sum, total);
+  printf("aligned SSE loads summed to %g\n", sum[0]);
+
+  // Like the C library's, zero byte requests return a block
+  void * e = malloc(0);
+  void * r = realloc(NULL, 0);
+  printf("malloc(0) and realloc(NULL, 0) returned blocks: %s\n",
+         e != NULL && r != NULL ? "yes" : "no");
+
+  // A child forked while other threads use the allocator can still allocate
+  pthread_t threads[N_THREADS];
+  for (int i = 0; i < N_THREADS; i++) {
+    pthread_create(&threads[i], NULL, churn, NULL);
+  }
+  pid_t pid = fork();
+  if (pid == 0) {
+    churn(NULL);
+    _exit(0);
+  }
+  int status;
+  waitpid(pid, &status, 0);
+  printf("child exited: %d\n", WIFEXITED(status) ? WEXITSTATUS(status) : -1);
+  for (int i = 0; i < N_THREADS; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  printf("threads done\n");
+
+  free(s);
+  free(z);
+  free(m);
+  free(p);
+  free(a);
+  free(e);
+  free(r);
+  printf("verify: %s\n", verify() ? "passed" : "failed");
+}
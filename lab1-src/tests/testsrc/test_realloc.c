@@ -0,0 +1,61 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "testing.h"
+
+static bool holds(char * p, char c, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    if (p[i] != c) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static char * reallocing(char * p, size_t size) {
+  printf("reallocing ");
+  print_pointer(p - ALLOC_HEADER_SIZE);
+  printf(" to %zu bytes\n", size);
+  char * q = my_realloc(p, size);
+  printf("block %s\n", q == p ? "resized in place" : "moved");
+  tags_print(print_status);
+  puts("\n");
+  verify();
+  return q;
+}
+
+int main() {
+  initialize_test(__FILE__);
+
+  // Blocks are carved from the high end so p is right of q, q right of r
+  char * p = mallocing(64, print_status, false);
+  char * q = mallocing(64, print_status, false);
+  char * r = mallocing(64, print_status, false);
+  memset(r, 'r', 64);
+
+  // Shrinking returns the tail to the free lists
+  r = reallocing(r, 16);
+  printf("data kept: %s\n", holds(r, 'r', 16) ? "yes" : "no");
+
+  // Growing absorbs the free tail and a freed right neighbour
+  freeing(q, 64, print_status, false);
+  r = reallocing(r, 120);
+  printf("data kept: %s\n", holds(r, 'r', 16) ? "yes" : "no");
+  memset(r, 'r', 120);
+
+  // A block with an allocated right neighbour has to move and copies only
+  // the bytes it holds
+  r = reallocing(r, 400);
+  printf("data kept: %s\n", holds(r, 'r', 120) ? "yes" : "no");
+
+  // Reallocating NULL allocates and reallocating to 0 frees
+  char * s = my_realloc(NULL, 8);
+  printf("realloc(NULL, 8) %s\n", s != NULL ? "allocated" : "failed");
+  printf("realloc(p, 0) returned %s\n", my_realloc(s, 0) == NULL ? "NULL" : "a block");
+
+  memset(r, 0, 400);
+  freeing(r, 400, print_status, false);
+  freeing(p, 64, print_status, false);
+
+  finalize_test();
+}
@@ -0,0 +1,48 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "testing.h"
+
+int main() {
+  initialize_test(__FILE__);
+
+  my_region * r = my_region_create();
+
+  // Small requests are bumped through one block, rounded to the alignment
+  char * a = my_region_alloc(r, 10);
+  char * b = my_region_alloc(r, 24);
+  char * c = my_region_alloc(r, 1);
+  printf("offsets in block: %td %td\n", b - a, c - a);
+  printf("zero bytes: %s\n", my_region_alloc(r, 0) == NULL ? "NULL" : "a block");
+
+  // Filling the first block moves on to a second one
+  size_t count = 3;
+  char * p;
+  do {
+    p = my_region_alloc(r, 64);
+    count++;
+  } while (p >= a && p < a + REGION_BLOCK_SIZE);
+  printf("blocks after %zu allocations:\n", count);
+  tags_print(print_status);
+  puts("");
+
+  // A large request gets a block of its own
+  char * large = my_region_alloc(r, REGION_BLOCK_SIZE);
+  memset(large, 1, REGION_BLOCK_SIZE);
+  printf("blocks after a large allocation:\n");
+  tags_print(print_status);
+  puts("");
+
+  // A reset frees the large block and starts over in the first block
+  my_region_reset(r);
+  printf("first allocation after reset reuses the first block: %s\n",
+         my_region_alloc(r, 10) == a ? "yes" : "no");
+  printf("blocks after reset:\n");
+  tags_print(print_status);
+  puts("");
+
+  my_region_destroy(r);
+  printf("verify: %s\n", verify() ? "passed" : "failed");
+
+  finalize_test();
+}
@@ -0,0 +1,81 @@
+#include <pthread.h>
+#include <stdio.h>
+
+#include "testing.h"
+
+#define NTHREADS 4
+#define NBLOCKS 1000
+
+static size_t allocated_blocks;
+
+static void count_allocated(header * block) {
+  if (get_state(block) == ALLOCATED) {
+    allocated_blocks++;
+  }
+}
+
+static size_t count_allocated_blocks() {
+  allocated_blocks = 0;
+  tags_print(count_allocated);
+  return allocated_blocks;
+}
+
+static void * free_one(void * p) {
+  my_free(p);
+  return NULL;
+}
+
+// Each thread frees every NTHREADS-th block, racing the others' pushes
+static void * free_share(void * arg) {
+  void ** blocks = arg;
+  for (int i = 0; i < NBLOCKS; i += NTHREADS) {
+    my_free(blocks[i]);
+  }
+  return NULL;
+}
+
+int main() {
+  initialize_test(__FILE__);
+
+  // The main thread's block is freed by a thread that has no arena
+  void * p = mallocing(100, print_status, false);
+  pthread_t thread;
+  pthread_create(&thread, NULL, free_one, p);
+  pthread_join(thread, NULL);
+  printf("freed by another thread, still allocated until the arena drains:\n");
+  tags_print(print_status);
+  puts("\n");
+
+  // The next allocation from the main arena frees it
+  void * q = mallocing(8, print_status, false);
+  freeing(q, 8, print_status, false);
+
+  void * blocks[NBLOCKS];
+  for (int i = 0; i < NBLOCKS; i++) {
+    blocks[i] = my_malloc(8 + i % 200);
+  }
+  void * r = my_malloc(8);
+  printf("allocated blocks: %zu\n", count_allocated_blocks());
+
+  pthread_t threads[NTHREADS];
+  for (int i = 0; i < NTHREADS; i++) {
+    pthread_create(&threads[i], NULL, free_share, &blocks[i]);
+  }
+  for (int i = 0; i < NTHREADS; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  printf("allocated blocks after remote frees: %zu\n", count_allocated_blocks());
+
+  // Freeing a block of the arena drains it as well as allocating
+  my_free(r);
+  printf("allocated blocks after a free drains the arena: %zu\n", count_allocated_blocks());
+
+  // So does my_malloc_trim
+  p = my_malloc(100);
+  pthread_create(&thread, NULL, free_one, p);
+  pthread_join(thread, NULL);
+  my_malloc_trim(0);
+  printf("allocated blocks after trimming: %zu\n", count_allocated_blocks());
+
+  finalize_test();
+}
@@ -0,0 +1,40 @@
+#include <stdio.h>
+
+#include "testing.h"
+
+int main() {
+  initialize_test(__FILE__);
+
+  // Blocks up to 256 bytes past the header get a list per size, larger ones
+  // share lists covering a quarter of each doubling
+  void * a = mallocing(200, print_status, true);
+  void * s1 = mallocing(8, print_status, true);
+  void * b = mallocing(300, print_status, true);
+  void * s2 = mallocing(8, print_status, true);
+  void * c = mallocing(330, print_status, true);
+  void * s3 = mallocing(8, print_status, true);
+  void * d = mallocing(1000, print_status, true);
+  void * s4 = mallocing(8, print_status, false);
+
+  freeing(a, 200, print_status, true);
+  freeing(b, 300, print_status, true);
+  freeing(c, 330, print_status, true);
+  freeing(d, 1000, print_status, false);
+  freelist_print(basic_print);
+  puts("\n");
+
+  // Smaller blocks share b's list, so a request its size is served from the
+  // next list where every block fits
+  void * e = mallocing(300, print_status, false);
+  freelist_print(basic_print);
+  puts("\n");
+
+  freeing(e, 300, print_status, true);
+  freeing(s1, 8, print_status, true);
+  freeing(s2, 8, print_status, true);
+  freeing(s3, 8, print_status, true);
+  freeing(s4, 8, print_status, false);
+  printf("verify: %s\n", verify() ? "passed" : "failed");
+
+  finalize_test();
+}
@@ -0,0 +1,80 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "testing.h"
+
+#define NTHREADS 4
+#define NALLOCS 4096
+
+static size_t allocated_blocks;
+
+static void count_allocated(header * block) {
+  if (get_state(block) == ALLOCATED) {
+    allocated_blocks++;
+  }
+}
+
+static size_t count_allocated_blocks() {
+  allocated_blocks = 0;
+  tags_print(count_allocated);
+  return allocated_blocks;
+}
+
+static void * worker(void * arg) {
+  size_t id = (size_t) arg;
+  static __thread char * ptrs[NALLOCS];
+  bool intact = true;
+
+  for (int round = 0; round < 20; round++) {
+    for (int i = 0; i < NALLOCS; i++) {
+      size_t size = 1 + (i * 7 + round) % SLAB_MAX_SIZE;
+      ptrs[i] = my_malloc(size);
+      memset(ptrs[i], (char) (id + i), size);
+    }
+    for (int i = 0; i < NALLOCS; i++) {
+      size_t size = 1 + (i * 7 + round) % SLAB_MAX_SIZE;
+      for (size_t j = 0; j < size; j++) {
+        intact = intact && ptrs[i][j] == (char) (id + i);
+      }
+      my_free(ptrs[i]);
+    }
+  }
+  return (void *) intact;
+}
+
+int main() {
+  initialize_test(__FILE__);
+
+  // Small requests come from slabs and leave the boundary tags untouched
+  void * small = mallocing(8, print_status, false);
+  void * limit = mallocing(SLAB_MAX_SIZE, print_status, false);
+  printf("allocated blocks with slab objects live: %zu\n", count_allocated_blocks());
+
+  // Slots of the same class are adjacent in their slab
+  void * next = my_malloc(8);
+  printf("distance between 8 byte slots: %td\n", (char *) next - (char *) small);
+  my_free(next);
+
+  // Larger requests still use boundary tags
+  void * large = mallocing(SLAB_MAX_SIZE + 1, print_status, false);
+  printf("allocated blocks with a large object live: %zu\n", count_allocated_blocks());
+
+  freeing(small, 8, print_status, true);
+  freeing(limit, SLAB_MAX_SIZE, print_status, true);
+  freeing(large, SLAB_MAX_SIZE + 1, print_status, false);
+
+  pthread_t threads[NTHREADS];
+  for (size_t i = 0; i < NTHREADS; i++) {
+    pthread_create(&threads[i], NULL, worker, (void *) i);
+  }
+  bool intact = true;
+  for (size_t i = 0; i < NTHREADS; i++) {
+    void * ok;
+    pthread_join(threads[i], &ok);
+    intact = intact && ok;
+  }
+  printf("%d threads %s\n", NTHREADS, intact ? "kept their data intact" : "corrupted data");
+
+  finalize_test();
+}
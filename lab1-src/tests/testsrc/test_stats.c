@@ -0,0 +1,49 @@
+#include <signal.h>
+#include <stdio.h>
+
+#include "testing.h"
+
+static void print_stats() {
+  allocator_stats stats = my_malloc_stats();
+  printf("in use: %zu, free: %zu, os: %zu in %zu chunks, largest free: %zu, "
+         "fragmentation: %.4f, lock wait: %s\n",
+         stats.inUseBytes, stats.freeBytes, stats.osBytes, stats.osChunks,
+         stats.largestFree, stats.fragmentation,
+         stats.lockWaitNanos == 0 ? "none" : "some");
+
+  // Write the JSON after anything still buffered for stdout
+  fflush(stdout);
+  my_malloc_stats_json(1);
+  puts("");
+}
+
+int main() {
+  initialize_test(__FILE__);
+  print_stats();
+
+  void * a = mallocing(8, print_status, true);
+  void * b = mallocing(8, print_status, true);
+  void * c = mallocing(1000, print_status, true);
+  void * d = mallocing(100, print_status, true);
+  void * e = mallocing(5000, print_status, false);
+  print_stats();
+
+  // Freeing c between allocated blocks leaves the free memory fragmented
+  freeing(c, 1000, print_status, false);
+  print_stats();
+
+  freeing(a, 8, print_status, true);
+  freeing(b, 8, print_status, true);
+  freeing(d, 100, print_status, true);
+  freeing(e, 5000, print_status, true);
+  print_stats();
+
+  // The handler writes the counters without walking the free lists
+  printf("installing the stats signal handler: %s\n",
+         my_malloc_stats_on_signal(SIGUSR1, 1) ? "done" : "failed");
+  fflush(stdout);
+  raise(SIGUSR1);
+  puts("");
+
+  finalize_test();
+}
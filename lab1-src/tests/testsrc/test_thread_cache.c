@@ -0,0 +1,87 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "testing.h"
+
+#define NTHREADS 8
+#define NALLOCS 64
+#define ROUNDS 1000
+
+static size_t allocated_blocks;
+
+static void count_allocated(header * block) {
+  if (get_state(block) == ALLOCATED) {
+    allocated_blocks++;
+  }
+}
+
+static size_t count_allocated_blocks() {
+  allocated_blocks = 0;
+  tags_print(count_allocated);
+  return allocated_blocks;
+}
+
+static void * worker(void * arg) {
+  size_t id = (size_t) arg;
+  char * ptrs[NALLOCS];
+  bool * ok = my_malloc(sizeof(bool));
+  *ok = true;
+
+  for (int round = 0; round < ROUNDS; round++) {
+    for (int i = 0; i < NALLOCS; i++) {
+      size_t size = 8 + (i % 16) * 8;
+      ptrs[i] = my_malloc(size);
+      memset(ptrs[i], (char) (id + i), size);
+    }
+    for (int i = 0; i < NALLOCS; i++) {
+      size_t size = 8 + (i % 16) * 8;
+      for (size_t j = 0; j < size; j++) {
+        if (ptrs[i][j] != (char) (id + i)) {
+          *ok = false;
+        }
+      }
+      my_free(ptrs[i]);
+    }
+  }
+  return ok;
+}
+
+int main() {
+  initialize_test(__FILE__);
+
+  void * p = mallocing(8, print_status, false);
+  freeing(p, 8, print_status, false);
+  void * q = mallocing(8, print_status, false);
+  printf("reallocating a freed block %s the thread cache\n",
+         p == q ? "hits" : "misses");
+  freeing(q, 8, print_status, false);
+
+  pthread_t threads[NTHREADS];
+  for (size_t i = 0; i < NTHREADS; i++) {
+    pthread_create(&threads[i], NULL, worker, (void *) i);
+  }
+  bool passed = true;
+  for (size_t i = 0; i < NTHREADS; i++) {
+    bool * ok;
+    pthread_join(threads[i], (void **) &ok);
+    passed = passed && *ok;
+    my_free(ok);
+  }
+  printf("%d threads %s\n", NTHREADS, passed ? "kept their data intact" : "corrupted data");
+
+  // Calls served from the thread caches are counted too
+  allocator_stats stats = my_malloc_stats();
+  size_t mallocs = 0;
+  size_t frees = 0;
+  for (int i = 0; i < N_LISTS; i++) {
+    mallocs += stats.mallocs[i];
+    frees += stats.frees[i];
+  }
+  printf("calls counted: %zu mallocs, %zu frees\n", mallocs, frees);
+
+  my_thread_cache_flush();
+  printf("allocated blocks after flushing: %zu\n", count_allocated_blocks());
+
+  printf("verify: %s\n", verify() ? "passed" : "failed");
+}
@@ -0,0 +1,107 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "testing.h"
+
+#define TRACE_PATH "/tmp/test_trace"
+#define MAX_RECORDS 64
+
+static const char * opNames[] = {
+  "malloc", "calloc", "memalign", "free", "realloc", "realloc result",
+};
+
+static void * worker(void * arg) {
+  void * p = my_malloc(64);
+  my_free(p);
+  return arg;
+}
+
+// Allocator calls of the traced child
+static void run_child() {
+  void * a = my_malloc(100);
+  void * b = my_calloc(4, 25);
+  void * c = my_memalign(64, 200);
+  a = my_realloc(a, 1000);
+  my_free(b);
+
+  pthread_t thread;
+  pthread_create(&thread, NULL, worker, NULL);
+  pthread_join(thread, NULL);
+
+  my_free(a);
+  my_free(c);
+
+  // Exiting runs the destructor writing out the trace
+  exit(0);
+}
+
+static void print_trace(const char * path) {
+  FILE * f = fopen(path, "rb");
+  if (f == NULL) {
+    printf("no trace written\n");
+    return;
+  }
+  uint64_t fileHeader[3];
+  trace_record records[MAX_RECORDS];
+  bool valid = fread(fileHeader, 1, TRACE_HEADER_SIZE, f) == TRACE_HEADER_SIZE &&
+    fileHeader[0] == TRACE_MAGIC && fileHeader[1] == TRACE_VERSION &&
+    fileHeader[2] == sizeof(trace_record);
+  size_t n = fread(records, sizeof(trace_record), MAX_RECORDS, f);
+  fclose(f);
+  printf("trace header valid: %s\n", valid ? "yes" : "no");
+
+  // Blocks are numbered in the order their addresses first appear
+  uint64_t addresses[MAX_RECORDS];
+  size_t numAddresses = 0;
+  bool ordered = true;
+  for (size_t i = 0; i < n; i++) {
+    size_t block = 0;
+    while (block < numAddresses && addresses[block] != records[i].ptr) {
+      block++;
+    }
+    if (block == numAddresses) {
+      addresses[numAddresses++] = records[i].ptr;
+    }
+    ordered &= i == 0 || records[i].nanos >= records[i - 1].nanos;
+
+    printf("%-15s size %4lu block %zu thread %u", opNames[records[i].op],
+           (unsigned long) records[i].size, block, records[i].thread);
+    if (records[i].op == TRACE_MEMALIGN) {
+      printf(" alignment %d", 1 << records[i].alignLog2);
+    }
+    printf("\n");
+  }
+  printf("timestamps in order: %s\n", ordered ? "yes" : "no");
+}
+
+int main(int argc, char ** argv) {
+  // Tracing starts as the allocator initializes, so run again with it on
+  if (getenv("MYMALLOC_TRACE") == NULL) {
+    setenv("MYMALLOC_TRACE", TRACE_PATH, 1);
+    execv("/proc/self/exe", argv);
+    perror("execv");
+    return 1;
+  }
+
+  initialize_test(__FILE__);
+
+  // A forked child writes its own trace
+  pid_t pid = fork();
+  if (pid == 0) {
+    run_child();
+  }
+  waitpid(pid, NULL, 0);
+
+  char path[64];
+  snprintf(path, sizeof(path), "%s.%d", TRACE_PATH, (int) pid);
+  print_trace(path);
+  unlink(path);
+  snprintf(path, sizeof(path), "%s.%d", TRACE_PATH, (int) getpid());
+  unlink(path);
+
+  finalize_test();
+}
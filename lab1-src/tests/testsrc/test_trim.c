@@ -0,0 +1,54 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "testing.h"
+
+static char * heap_end() {
+  return sbrk(0);
+}
+
+// Count the resident pages wholly inside a block's data
+static size_t resident_pages(char * p, size_t size) {
+  size_t page = getpagesize();
+  uintptr_t start = ((uintptr_t) p + sizeof(header) + page - 1) & ~(uintptr_t) (page - 1);
+  uintptr_t end = ((uintptr_t) p + size) & ~(uintptr_t) (page - 1);
+  size_t n = 0;
+  for (uintptr_t q = start; q < end; q += page) {
+    unsigned char vec;
+    if (mincore((void *) q, page, &vec) == 0 && (vec & 1)) {
+      n++;
+    }
+  }
+  return n;
+}
+
+int main() {
+  initialize_test(__FILE__);
+
+  // Each block needs a new chunk so b is above a at the top of the heap
+  char * a = mallocing(100000, print_status, false);
+  char * b = mallocing(100000, print_status, false);
+  char * c = mallocing(64, print_status, false);
+
+  // A large free block in the middle of the heap gives back its pages
+  printf("resident pages in a: %s\n", resident_pages(a, 100000) > 0 ? "some" : "none");
+  freeing(a, 100000, print_status, false);
+  printf("resident pages in a after free: %s\n", resident_pages(a, 100000) > 0 ? "some" : "none");
+
+  // Freeing the top of the heap shrinks it, keeping half the threshold
+  char * end = heap_end();
+  freeing(b, 100000, print_status, false);
+  printf("heap shrunk: %s\n", heap_end() < end ? "yes" : "no");
+
+  // Trimming by hand releases the rest
+  end = heap_end();
+  printf("my_malloc_trim returned %d\n", my_malloc_trim(0));
+  printf("heap shrunk: %s\n", heap_end() < end ? "yes" : "no");
+
+  freeing(c, 64, print_status, false);
+
+  finalize_test();
+}